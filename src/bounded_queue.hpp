@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template<typename TValueType>
+class BoundedQueue
+{
+	/*
+		Thread safe FIFO queue with a fixed capacity, used to connect the stages of a pipeline.
+		Push blocks while the queue is full and Pop blocks while the queue is empty.
+		After Close was called, Pop returns the remaining elements and then false.
+	*/
+public:
+	BoundedQueue(const size_t& capacity) :capacity_(capacity), closed_(false) {}
+
+	// Disable copy-constructor.
+	BoundedQueue(const BoundedQueue&) = delete;
+
+	void Push(TValueType value) {
+		std::unique_lock<std::mutex> lock(mtx_);
+		not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+		queue_.push_back(std::move(value));
+		not_empty_.notify_one();
+	}
+
+	bool Pop(TValueType& value) {
+		std::unique_lock<std::mutex> lock(mtx_);
+		not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+		if (queue_.empty()) {
+			return false;
+		}
+		value = std::move(queue_.front());
+		queue_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	/*
+		Signals that no more elements will be pushed.
+	*/
+	void Close() {
+		std::lock_guard<std::mutex> lock(mtx_);
+		closed_ = true;
+		not_empty_.notify_all();
+	}
+
+private:
+	size_t capacity_;
+	bool closed_;
+	std::deque<TValueType> queue_;
+	std::mutex mtx_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+};
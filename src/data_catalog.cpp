@@ -0,0 +1,62 @@
+﻿#include <algorithm>
+#include <filesystem>
+
+#include "time_helper.hpp"
+
+#include "data_catalog.hpp"
+
+/*
+	Collects the source files P<YYYYMMDD_HH> of the source directory.
+*/
+DataCatalog::DataCatalog(const std::string& src_path, const std::string& preproc_path)
+	:src_path_(src_path),
+	preproc_path_(preproc_path)
+{
+	namespace fs = std::filesystem;
+	for (const auto& file : fs::directory_iterator(src_path_))
+	{
+		std::string file_name = file.path().filename().string();
+		if (file_name[0] == 'P' && file_name[1] != 'P' && file_name.size() == 12) {
+			time_steps_.push_back(file_name.substr(1, file_name.size() - 1));
+		}
+	}
+	std::sort(time_steps_.begin(), time_steps_.end());
+	if (time_steps_.empty()) return;
+
+	data_start_date_ = time_steps_[0];
+	for (const std::string& time_step : time_steps_) {
+		hours_.push_back(TimeHelper::ConvertDateToHours(time_step, data_start_date_));
+		data_paths_.push_back(src_path_ + "P" + time_step);
+	}
+}
+
+size_t DataCatalog::GetHours(const std::string& date) const {
+	return TimeHelper::ConvertDateToHours(date, data_start_date_);
+}
+
+std::string DataCatalog::GetDate(const size_t& time) const {
+	size_t index = FindTimeStep(time);
+	if (index < time_steps_.size()) {
+		return time_steps_[index];
+	}
+	return TimeHelper::ConvertHoursToDate(time, data_start_date_);
+}
+
+/*
+	Returns the path of the source file of the time step.
+*/
+std::string DataCatalog::GetDataPath(const size_t& time) const {
+	size_t index = FindTimeStep(time);
+	if (index < time_steps_.size()) {
+		return data_paths_[index];
+	}
+	return src_path_ + "P" + TimeHelper::ConvertHoursToDate(time, data_start_date_);
+}
+
+size_t DataCatalog::FindTimeStep(const size_t& time) const {
+	auto it = std::lower_bound(hours_.begin(), hours_.end(), time);
+	if (it != hours_.end() && *it == time) {
+		return (size_t)(it - hours_.begin());
+	}
+	return time_steps_.size();
+}
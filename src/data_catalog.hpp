@@ -0,0 +1,36 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+
+class DataCatalog
+{
+	/*
+		The time steps of the source directory and the paths of the data. The source directory is scanned once on construction,
+		afterwards the catalog is only read, such that it can be shared by all threads.
+		Time steps are identified by the hours since the first time step, see TimeHelper.
+	*/
+public:
+	DataCatalog(const std::string& src_path, const std::string& preproc_path);
+
+	const std::string& GetSrcPath() const { return src_path_; }
+	const std::string& GetPreprocPath() const { return preproc_path_; }
+	// The dates YYYYMMDD_HH of all source files, sorted by time.
+	const std::vector<std::string>& GetTimeSteps() const { return time_steps_; }
+	const std::string& GetDataStartDate() const { return data_start_date_; }
+
+	size_t GetHours(const std::string& date) const;
+	std::string GetDate(const size_t& time) const;
+	std::string GetDataPath(const size_t& time) const;
+
+private:
+	std::string src_path_;
+	std::string preproc_path_;
+	std::vector<std::string> time_steps_;
+	std::string data_start_date_;
+	// Hours and source file paths of the time steps, in the same order as time_steps_.
+	std::vector<size_t> hours_;
+	std::vector<std::string> data_paths_;
+
+	// Returns the index of the time step in time_steps_, or time_steps_.size() if there is no source file for it.
+	size_t FindTimeStep(const size_t& time) const;
+};
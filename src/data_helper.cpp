@@ -1,120 +1,121 @@
-﻿#include <filesystem>
-#include <fstream>
-
-#include "line_collection.hpp"
-#include "time_helper.hpp"
+﻿#include "line_collection.hpp"
 #include "netcdf.hpp"
 
 #include "data_helper.hpp"
 /*
-	Loads data from the source directory.
+	Loads the levels [level_range[0], level_range[1]] of a field from an opened file of the source directory.
 */
-RegScalarField3f* DataHelper::LoadRegScalarField3f(const std::string& field_name, const size_t& time) {
-	std::string time_step = "P" + TimeHelper::ConvertHoursToDate(time, GetDataStartDate());
-	std::string path = GetSrcPath() + time_step;;
-	RegScalarField3f* field = NetCDF::ImportScalarField3f(path, field_name, "lon", "lat", "lev");
+RegScalarField3f* DataHelper::LoadRegScalarField3f(NetCDF::File& file, const std::string& field_name, const Vec2i& level_range) {
+	RegScalarField3f* field = file.ImportScalarField3f(field_name, "lon", "lat", "lev", (size_t)level_range[0], (size_t)(level_range[1] - level_range[0] + 1));
 	if (field == NULL){
 		std::cout << std::endl;
-		std::cout << "The following field was not found in the data "<< time_step<<": " << field_name << std::endl;
+		std::cout << "The following field was not found in the data "<< file.GetPath() <<": " << field_name << std::endl;
 		std::cout << "exiting" << std::endl;
 		std::exit(2);
 	}
 	return field;
 }
 /*
-	Loads a vector of scalar fields.
+	Loads a vector of scalar fields. All fields are read from the same opened file, which serializes the reads.
 */
-std::vector<RegScalarField3f*> DataHelper::LoadScalarFields(const size_t& time, const std::vector<std::string>& field_names) {
-	int n_fields = (int)field_names.size();
-	std::vector<RegScalarField3f*> fields(n_fields, NULL);
-
-#pragma omp parallel for schedule(dynamic,16)
-	for (int i = 0; i < n_fields; i++) {
-			fields[i] = LoadRegScalarField3f(field_names[i], time);
+std::vector<RegScalarField3f*> DataHelper::LoadScalarFields(NetCDF::File& file, const std::vector<std::string>& field_names, const Vec2i& level_range) {
+	std::vector<RegScalarField3f*> fields(field_names.size(), NULL);
+	for (size_t i = 0; i < field_names.size(); i++) {
+		fields[i] = LoadRegScalarField3f(file, field_names[i], level_range);
 	}
 	return fields;
 }
 
 /*
-	Returns the 3D pressure in (lon, lat, level) coordinates.
-	Saves the max and min Pressure values in the mScalarRange fields of the Scalar field.
+	Returns the range of all levels in the file. Exits if the file could not be opened or has no level axis.
 */
-RegScalarField3f* DataHelper::ComputePS3D(const std::string& time, const Vec3i& resolution, const BoundingBox3d& domain) {
-
-
-	std::string path = GetSrcPath() + "P" + time;
-
-	RegScalarField3f* pressure_3d = new RegScalarField3f(resolution, domain);
-
-	std::vector<float> lev, hyam, hybm;
-	if (!NetCDF::ImportFloatArray(path, "lev", lev)) return NULL;
-	if (!NetCDF::ImportFloatArray(path, "hyam", hyam)) return NULL;
-	if (!NetCDF::ImportFloatArray(path, "hybm", hybm)) return NULL;
-
-	RegScalarField2f* pressure_2d = NetCDF::ImportScalarField2f(path, "PS", "lon", "lat");
-	float min_pressure = 1000000;
-	float max_pressure = -1;
-
-	size_t num_entries = (size_t)pressure_3d->GetResolution()[0] * (size_t)pressure_3d->GetResolution()[1] * (size_t)pressure_3d->GetResolution()[2];
-#pragma omp parallel for schedule(dynamic,16)
-	for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-		Vec3i coords = pressure_3d->GetGridCoord(linear_index);
-		int i = coords[0];
-		int j = coords[1];
-		int k = coords[2];
-
-		float pressure = hyam[(size_t)std::round(lev[k]) - 1] * 0.01f + hybm[(size_t)std::round(lev[k]) - 1] * pressure_2d->GetVertexDataAt(Vec2i({ i, j }));
-		if (pressure < min_pressure) { min_pressure = pressure; }
-		if (pressure > max_pressure) { max_pressure = pressure; }
-		pressure_3d->SetVertexDataAt(coords, pressure);
+Vec2i DataHelper::GetLevelRange(NetCDF::File& file) {
+	if (file.IsOpen()) {
+		for (const NetCDF::Info::Dimension& dimension : file.GetInfo().Dimensions) {
+			if (dimension.GetName() == "lev") {
+				return Vec2i({ 0, (int)dimension.GetLength() - 1 });
+			}
+		}
 	}
+	std::cout << std::endl;
+	std::cout << "The level axis lev was not found in the data " << file.GetPath() << std::endl;
+	std::cout << "exiting" << std::endl;
+	std::exit(2);
+}
 
-	pressure_3d->SetScalarRange(min_pressure, max_pressure);
+/*
+	Returns the smallest range of levels, which contains the pressure band [ps_min, ps_max] in every column.
+	Because the 3D pressure hyam + hybm * PS grows with the surface pressure, the column with the largest surface pressure bounds the upper
+	end of the range and the column with the smallest surface pressure bounds the lower end.
+	The range is padded by two levels, such that the smoothing and the gradient stencil see the same values as on the full grid inside the band.
+*/
+Vec2i DataHelper::ComputeLevelRange(NetCDF::File& file, const double& ps_min, const double& ps_max) {
+	const int padding = 2;
+	Vec2i full_range = GetLevelRange(file);
 
+	std::vector<float> lev, hyam, hybm;
+	if (!file.ImportFloatArray("lev", lev)) return full_range;
+	if (!file.ImportFloatArray("hyam", hyam)) return full_range;
+	if (!file.ImportFloatArray("hybm", hybm)) return full_range;
+
+	RegScalarField2f* pressure_2d = file.ImportScalarField2f("PS", "lon", "lat");
+	if (pressure_2d == NULL) return full_range;
+	const std::vector<float>& surface_pressure = pressure_2d->GetData();
+	float surface_pressure_min = *std::min_element(surface_pressure.begin(), surface_pressure.end());
+	float surface_pressure_max = *std::max_element(surface_pressure.begin(), surface_pressure.end());
 	delete pressure_2d;
-	return pressure_3d;
-}
-std::vector<std::string> DataHelper::CollectTimes() {
-	namespace fs = std::filesystem;
-	std::vector<std::string> times;
-	for (const auto& file : fs::directory_iterator(GetSrcPath()))
-	{
-		std::string file_name = file.path().filename().string();
-		if (file_name[0] == 'P' && file_name[1] != 'P' && file_name.size() == 12) {
-			std::string time = file_name.substr(1, file_name.size() - 1);
-			times.push_back(time);
+
+	int first_level = full_range[0];
+	int last_level = full_range[1];
+	for (int k = full_range[0]; k <= full_range[1]; k++) {
+		size_t coefficient_index = (size_t)std::round(lev[k]) - 1;
+		float highest_pressure = hyam[coefficient_index] * 0.01f + hybm[coefficient_index] * surface_pressure_max;
+		float lowest_pressure = hyam[coefficient_index] * 0.01f + hybm[coefficient_index] * surface_pressure_min;
+		if (highest_pressure <= ps_min) {
+			first_level = k;
+		}
+		if (lowest_pressure >= ps_max) {
+			last_level = std::min(last_level, k);
 		}
 	}
-	std::sort(times.begin(), times.end());
-	return times;
+	return Vec2i({ std::max(full_range[0], first_level - padding), std::min(full_range[1], last_level + padding) });
 }
 
-std::string DataHelper::GetDataStartDate() {
-	std::vector<std::string> time_steps = CollectTimes();
-	if (time_steps.size() == 0) {
-		std::cout << "No Data found" << std::endl;
-	}
-	return time_steps[0];
+/*
+	Returns whether the lat axis of the file runs from south to north. The fields keep the order of the file, so the latitude index of the
+	northern hemisphere is below the equator if not. Files without a lat axis are assumed to be ascending.
+*/
+bool DataHelper::IsLatitudeAscending(NetCDF::File& file) {
+	std::vector<float> lat;
+	if (!file.ImportFloatArray("lat", lat) || lat.empty()) return true;
+	return lat.front() <= lat.back();
 }
 
-std::string DataHelper::GetPreprocPath() {
-	std::ifstream settings_file("settings.txt");
-	std::string line;
-	std::getline(settings_file, line);
-	std::string srcPath = line.substr(16, line.size() - 16);
-	std::getline(settings_file, line);
-	std::string dstPath = line.substr(14, line.size() - 14);
-	return dstPath;
-};
-
-std::string DataHelper::GetSrcPath() {
-	std::ifstream settings_file("settings.txt");
-	std::string line;
-	std::getline(settings_file, line);
-	std::string srcPath = line.substr(16, line.size() - 16);
-	return srcPath;
-};
+/*
+	Returns the vertical coordinate of the loaded levels: the surface pressure PS and the hybrid coefficients hyam / 100 and hybm of the levels
+	level_offset ... level_offset + resolution[2] - 1. resolution is the resolution of the loaded 3D fields.
+*/
+HybridPressure* DataHelper::LoadHybridPressure(NetCDF::File& file, const Vec3i& resolution, const int& level_offset) {
+	std::vector<float> lev, hyam, hybm;
+	if (!file.ImportFloatArray("lev", lev)) return NULL;
+	if (!file.ImportFloatArray("hyam", hyam)) return NULL;
+	if (!file.ImportFloatArray("hybm", hybm)) return NULL;
+
+	RegScalarField2f* pressure_2d = file.ImportScalarField2f("PS", "lon", "lat");
+	if (pressure_2d == NULL) return NULL;
+
+	std::vector<float> a(resolution[2]);
+	std::vector<float> b(resolution[2]);
+	for (int k = 0; k < resolution[2]; k++) {
+		size_t coefficient_index = (size_t)std::round(lev[k + level_offset]) - 1;
+		a[k] = hyam[coefficient_index] * 0.01f;
+		b[k] = hybm[coefficient_index];
+	}
+	HybridPressure* pressure = new HybridPressure(resolution, pressure_2d->GetData(), a, b);
 
+	delete pressure_2d;
+	return pressure;
+}
 std::vector<float> DataHelper::GetPsAxis()
 {
   	int stepSize = 10;
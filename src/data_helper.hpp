@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include "era_grid.hpp"
 #include "line_collection.hpp"
+#include "netcdf.hpp"
 #include <string.h>
 
 class DataHelper
@@ -8,14 +9,13 @@ class DataHelper
 public:
 
 	//Data loading functions
-	static RegScalarField3f* LoadRegScalarField3f(const std::string& field_name, const size_t& time);
-	static std::vector<RegScalarField3f*> LoadScalarFields(const size_t& time, const std::vector<std::string>& field_names);
-	static RegScalarField3f* ComputePS3D(const std::string& time, const Vec3i& resolution, const BoundingBox3d& domain);
+	static RegScalarField3f* LoadRegScalarField3f(NetCDF::File& file, const std::string& field_name, const Vec2i& level_range);
+	static std::vector<RegScalarField3f*> LoadScalarFields(NetCDF::File& file, const std::vector<std::string>& field_names, const Vec2i& level_range);
+	static HybridPressure* LoadHybridPressure(NetCDF::File& file, const Vec3i& resolution, const int& level_offset);
+	static Vec2i GetLevelRange(NetCDF::File& file);
+	static Vec2i ComputeLevelRange(NetCDF::File& file, const double& ps_min, const double& ps_max);
+	static bool IsLatitudeAscending(NetCDF::File& file);
 
 	//Getters
-	static std::string GetSrcPath();
-	static std::string GetPreprocPath();
-	static std::string GetDataStartDate();
-	static std::vector<std::string> CollectTimes();
 	static std::vector<float> GetPsAxis();
 };
@@ -1,14 +1,72 @@
 ﻿#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "grid_iteration.hpp"
+#include "hybrid_pressure.hpp"
 #include "regular_grid.hpp"
 
+/*
+	The location of a position (lon index, lat index, pressure) relative to the model levels: the four surrounding columns, the bilinear weights
+	and the fractional level at which the pressure is equal to the searched pressure in each column.
+	The level search only depends on the vertical coordinate, so one location can be used to sample any number of EraGrid fields on the same levels.
+*/
+struct EraLocation {
+	int i_down, i_up, j_down, j_up;
+	// i - i_down and j - j_down.
+	double weight_i, weight_j;
+	// Levels in the columns (i_down, j_down), (i_up, j_down), (i_down, j_up), (i_up, j_up).
+	double level[4];
+};
+
+class EraLocator {
+public:
+	using TDomainCoord = Vec<double, 3>;
+
+	EraLocator(const HybridPressure* pressure) :
+		pressure_(pressure)
+	{
+	}
+
+	EraLocation Locate(const TDomainCoord& coord) const {
+		EraLocation location;
+		double i = coord[0];
+		double j = coord[1];
+		double k = coord[2];
+		location.i_down = std::min(std::max(0, (int)std::floor(i)), pressure_->GetResolution()[0] - 1);
+		location.i_up = std::min(std::max(0, (int)std::ceil(i)), pressure_->GetResolution()[0] - 1);
+		location.j_down = std::min(std::max(0, (int)std::floor(j)), pressure_->GetResolution()[1] - 1);
+		location.j_up = std::min(std::max(0, (int)std::ceil(j)), pressure_->GetResolution()[1] - 1);
+		location.weight_i = i - location.i_down;
+		location.weight_j = j - location.j_down;
+
+		location.level[0] = FindLevel(location.i_down, location.j_down, k);
+		location.level[1] = FindLevel(location.i_up, location.j_down, k);
+		location.level[2] = FindLevel(location.i_down, location.j_up, k);
+		location.level[3] = FindLevel(location.i_up, location.j_up, k);
+		return location;
+	}
+
+	/*
+		Returns the fractional level k, where the pressure is equal to searched_ps at the grid coordinates (i,j).
+	*/
+	double FindLevel(const int& i, const int& j, const double& searched_ps) const {
+		return pressure_->FindLevel(i, j, searched_ps);
+	}
+
+private:
+	const HybridPressure* pressure_;
+};
+
 template<typename TValueType>
 class EraGrid {
 public:
 	using TDomainCoord = Vec<double, 3>;
 
-	EraGrid(RegularGrid<TValueType, 3>* field, RegScalarField3f* ps) :
+	EraGrid(RegularGrid<TValueType, 3>* field, const HybridPressure* pressure) :
 		field_(field),
-		ps_(ps)
+		pressure_(pressure),
+		locator_(pressure)
 	{
 	}
 	/*
@@ -17,93 +75,65 @@ public:
 	*/
 	virtual TValueType Sample(const TDomainCoord& coord) const
 	{
-		double i = coord[0];
-		double j = coord[1];
-		double k = coord[2];
-		int i_down = (int)std::floor(i);
-		i_down = std::min(std::max(0, i_down), field_->GetResolution()[0] - 1);
-		int i_up = (int)std::ceil(i);
-		i_up = std::min(std::max(0, i_up), field_->GetResolution()[0] - 1);
-		int j_down = (int)std::floor(j);
-		j_down = std::min(std::max(0, j_down), field_->GetResolution()[1] - 1);
-		int j_up = (int)std::ceil(j);
-		j_up = std::min(std::max(0, j_up), field_->GetResolution()[1] - 1);
-
-		TValueType v_id_jd = BinarySearch(i_down, j_down, k);
-		TValueType v_iu_jd = BinarySearch(i_up, j_down, k);
-		TValueType v_id_ju = BinarySearch(i_down, j_up, k);
-		TValueType v_iu_ju = BinarySearch(i_up, j_up, k);
+		return Sample(locator_.Locate(coord));
+	}
+	/*
+		Samples the field at a location computed by an EraLocator on the same vertical coordinate.
+	*/
+	TValueType Sample(const EraLocation& location) const
+	{
+		TValueType v_id_jd = ValueAtLevel(location.i_down, location.j_down, location.level[0]);
+		TValueType v_iu_jd = ValueAtLevel(location.i_up, location.j_down, location.level[1]);
+		TValueType v_id_ju = ValueAtLevel(location.i_down, location.j_up, location.level[2]);
+		TValueType v_iu_ju = ValueAtLevel(location.i_up, location.j_up, location.level[3]);
 
-		TValueType v_front_face = LinearInterpolate(i_down, i_up, v_id_jd, v_iu_jd, i);
-		TValueType v_rear_face = LinearInterpolate(i_down, i_up, v_id_ju, v_iu_ju, i);
+		TValueType v_front_face = LinearInterpolate(v_id_jd, v_iu_jd, location.weight_i);
+		TValueType v_rear_face = LinearInterpolate(v_id_ju, v_iu_ju, location.weight_i);
 
-		TValueType v = LinearInterpolate(j_down, j_up, v_front_face, v_rear_face, j);
+		TValueType v = LinearInterpolate(v_front_face, v_rear_face, location.weight_j);
 
 		return v;
 	}
 	RegularGrid<TValueType, 3>* GetField()const {
 		return field_;
 	}
+	/*
+		Resamples the field onto a regular grid with the pressure levels ps_axis in hPa, which have to be ascending and equidistant.
+		The domain of the result is (0 : n_lon - 1, 0 : n_lat - 1, ps_axis.front() : ps_axis.back()), such that RegularGrid::Sample
+		takes the same coordinates as Sample.
+	*/
+	RegularGrid<TValueType, 3>* ResampleToPressureAxis(const std::vector<float>& ps_axis) const {
+		const Vec3i res = Vec3i({ field_->GetResolution()[0], field_->GetResolution()[1], (int)ps_axis.size() });
+		BoundingBox3d domain(Vec3d({ 0., 0., (double)ps_axis.front() }), Vec3d({ res[0] - 1., res[1] - 1., (double)ps_axis.back() }));
+		RegularGrid<TValueType, 3>* resampled = new RegularGrid<TValueType, 3>(res, domain);
+		TValueType* resampled_data = resampled->GetData().data();
+		ForEachVoxel(res, [&](const int& i, const int& j, const int& k, const int64_t& linear_index) {
+			resampled_data[linear_index] = ValueAtLevel(i, j, locator_.FindLevel(i, j, ps_axis[k]));
+		});
+		return resampled;
+	}
 private:
 	RegularGrid<TValueType, 3>* field_;
-	RegScalarField3f* ps_;
+	const HybridPressure* pressure_;
+	EraLocator locator_;
 
 	/*
-		Returns the value of field_ at level k. Where k is the level where the 3D pressure is equal to searched_ps at the grid coordinates(i,j).
+		Returns the value of field_ at the fractional level in the column (i,j).
 	*/
-	TValueType BinarySearch(const int& i, const int& j, const double& searched_ps) const {
-		//search level for which at position (i,j) the 3d Pressure is searched_ps
-		double level = 0.;
-		int l = 0;
-		int r = ps_->GetResolution()[2] - 1;
-		//Border Cases: if there is no pressure p at position (i,j) with min_p <= p <= max_p where min_p and max_p are the smallest and largest value in this column
-		//we set level to 0 or to the max level.
-		if (searched_ps <= ps_->GetVertexDataAt(Vec3i({ i, j, 0 }))) {
-			level = 0.0;
-		}
-		else if (searched_ps >= ps_->GetVertexDataAt(Vec3i({ i, j, ps_->GetResolution()[2] - 1 }))) {
-			level = ps_->GetResolution()[2] - 1.0;
-		}
-		else {
-			//Binary search with integrated linear interpolation
-			while (l < r) {
-				int m = l + (r - l) / 2;
-				float ps_atm = ps_->GetVertexDataAt(Vec3i({ i, j, m }));
-				if (ps_atm == searched_ps) {
-					level = m;
-					break;
-				}
-				if (l + 1 == r) {
-					double psl = (double)ps_->GetVertexDataAt(Vec3i({ i, j, l }));
-					double psr = (double)ps_->GetVertexDataAt(Vec3i({ i, j, r }));
-
-					level = l + ((searched_ps - psl) / (psr - psl));
-					break;
-				}
-				if (ps_atm < searched_ps) {
-					l = m;
-				}
-				else {
-					r = m;
-				}
-			}
-		}
-
+	TValueType ValueAtLevel(const int& i, const int& j, const double& level) const {
 		int lev_down = (int)std::floor(level);
 		int lev_up = (int)std::ceil(level);
 
 		TValueType val_down = field_->GetVertexDataAt(Vec3i({ i, j, lev_down }));
 		TValueType val_up = field_->GetVertexDataAt(Vec3i({ i, j, lev_up }));
 
-		TValueType interpol_value = LinearInterpolate(lev_down, lev_up, val_down, val_up, level);
-
-		return interpol_value;
+		return LinearInterpolate(val_down, val_up, level - lev_down);
 	}
 	/*
-		Performs linear interpolation with the assumption that x2-x1 = 1.
+		Performs linear interpolation with the assumption that x2-x1 = 1. weight is x - x1.
 	*/
-	TValueType LinearInterpolate(const double& x1, const double& x2, const TValueType& y1, const TValueType& y2, double x) const {
-		return TValueType(y1 + (y2 - y1) * (float)(x - x1));
+	TValueType LinearInterpolate(const TValueType& y1, const TValueType& y2, const double& weight) const {
+		return TValueType(y1 + (y2 - y1) * (float)weight);
 	}
 };
 
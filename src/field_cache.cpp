@@ -0,0 +1,218 @@
+﻿#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#ifdef _WIN32
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "field_cache.hpp"
+
+static const char cache_magic[8] = { 'J', 'E', 'T', 'F', 'L', 'D', 'S', '\0' };
+static const uint32_t cache_version = 3;
+static const uint64_t cache_alignment = 64;
+static const int cache_num_arrays = 7;
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t resolution[3];
+	double domain_min[3];
+	double domain_max[3];
+	int32_t latitude_ascending;
+	FieldCache::Key key;
+	uint64_t offsets[cache_num_arrays];
+	uint64_t sizes[cache_num_arrays];
+};
+
+/*
+	Read only view of a whole file. Memory mapped on POSIX systems, read into a buffer otherwise.
+*/
+class MappedFile
+{
+public:
+	MappedFile(const std::string& path) :data_(nullptr), size_(0) {
+#ifdef _WIN32
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) return;
+		buffer_.resize((size_t)file.tellg());
+		file.seekg(0);
+		if (!file.read(buffer_.data(), buffer_.size())) return;
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat file_stat;
+		if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+			void* mapped = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED) {
+				data_ = (const char*)mapped;
+				size_ = (size_t)file_stat.st_size;
+			}
+		}
+		close(fd);
+#endif
+	}
+	~MappedFile() {
+#ifndef _WIN32
+		if (data_ != nullptr) munmap((void*)data_, size_);
+#endif
+	}
+	MappedFile(const MappedFile&) = delete;
+
+	const char* GetData() const { return data_; }
+	size_t GetSize() const { return size_; }
+
+private:
+	const char* data_;
+	size_t size_;
+#ifdef _WIN32
+	std::vector<char> buffer_;
+#endif
+};
+
+static bool KeysMatch(const FieldCache::Key& a, const FieldCache::Key& b) {
+	return a.load_level_range == b.load_level_range && a.ps_min_tracing == b.ps_min_tracing && a.ps_max_tracing == b.ps_max_tracing;
+}
+
+/*
+	Copies the array with index array_index into a vector of num_values values. Returns false if the array has a different size.
+*/
+template<typename TValueType>
+static bool ReadVector(const MappedFile& file, const CacheHeader& header, const int& array_index, const size_t& num_values, std::vector<TValueType>& values) {
+	uint64_t num_bytes = num_values * sizeof(TValueType);
+	if (header.sizes[array_index] != num_bytes || header.offsets[array_index] + num_bytes > file.GetSize()) {
+		return false;
+	}
+	values.resize(num_values);
+	std::memcpy(values.data(), file.GetData() + header.offsets[array_index], num_bytes);
+	return true;
+}
+
+/*
+	Reads the surface pressure and the hybrid coefficients from the arrays 0, 1 and 2.
+*/
+static HybridPressure* ReadHybridPressure(const MappedFile& file, const CacheHeader& header) {
+	Vec3i resolution = Vec3i({ header.resolution[0], header.resolution[1], header.resolution[2] });
+	std::vector<float> surface_pressure, a, b;
+	if (!ReadVector(file, header, 0, (size_t)resolution[0] * resolution[1], surface_pressure)
+		|| !ReadVector(file, header, 1, (size_t)resolution[2], a)
+		|| !ReadVector(file, header, 2, (size_t)resolution[2], b)) {
+		return nullptr;
+	}
+	return new HybridPressure(resolution, surface_pressure, a, b);
+}
+
+/*
+	Allocates a grid with the resolution and domain of the header and copies the array with index array_index into it.
+*/
+template<typename TValueType>
+static RegularGrid<TValueType, 3>* ReadArray(const MappedFile& file, const CacheHeader& header, const int& array_index) {
+	Vec3i resolution = Vec3i({ header.resolution[0], header.resolution[1], header.resolution[2] });
+	BoundingBox3d domain(Vec3d({ header.domain_min[0], header.domain_min[1], header.domain_min[2] }), Vec3d({ header.domain_max[0], header.domain_max[1], header.domain_max[2] }));
+	RegularGrid<TValueType, 3>* grid = new RegularGrid<TValueType, 3>(resolution, domain);
+	std::vector<TValueType>& data = grid->GetData();
+	uint64_t num_bytes = data.size() * sizeof(TValueType);
+	if (header.sizes[array_index] != num_bytes || header.offsets[array_index] + num_bytes > file.GetSize()) {
+		delete grid;
+		return nullptr;
+	}
+	std::memcpy(data.data(), file.GetData() + header.offsets[array_index], num_bytes);
+	return grid;
+}
+
+std::string FieldCache::GetPath(const DataCatalog& catalog, const size_t& time) {
+	return catalog.GetPreprocPath() + catalog.GetDate(time) + "_fields.bin";
+}
+
+bool FieldCache::Read(const std::string& path, const std::string& source_path, const Key& key, Fields& fields) {
+	namespace fs = std::filesystem;
+	std::error_code error;
+	if (!fs::exists(path, error)) return false;
+	if (fs::exists(source_path, error) && fs::last_write_time(source_path, error) > fs::last_write_time(path, error)) return false;
+
+	MappedFile file(path);
+	if (file.GetData() == nullptr || file.GetSize() < sizeof(CacheHeader)) return false;
+	CacheHeader header;
+	std::memcpy(&header, file.GetData(), sizeof(CacheHeader));
+	if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version || !KeysMatch(header.key, key)) return false;
+
+	Fields result;
+	result.pressure = ReadHybridPressure(file, header);
+	result.wind_direction_normalized = ReadArray<Vec3f>(file, header, 3);
+	result.wind_magnitude = ReadArray<float>(file, header, 4);
+	result.wind_magnitude_smooth = ReadArray<float>(file, header, 5);
+	result.grad_wind_magnitude = ReadArray<Vec3f>(file, header, 6);
+	result.latitude_ascending = header.latitude_ascending != 0;
+	if (!result.pressure || !result.wind_direction_normalized || !result.wind_magnitude || !result.wind_magnitude_smooth || !result.grad_wind_magnitude) {
+		delete result.pressure;
+		delete result.wind_direction_normalized;
+		delete result.wind_magnitude;
+		delete result.wind_magnitude_smooth;
+		delete result.grad_wind_magnitude;
+		return false;
+	}
+	fields = result;
+	return true;
+}
+
+bool FieldCache::Write(const std::string& path, const Key& key, const Fields& fields) {
+	CacheHeader header{};
+	std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = cache_version;
+	for (int d = 0; d < 3; d++) {
+		header.resolution[d] = fields.wind_magnitude->GetResolution()[d];
+		header.domain_min[d] = fields.wind_magnitude->GetDomain().GetMin()[d];
+		header.domain_max[d] = fields.wind_magnitude->GetDomain().GetMax()[d];
+	}
+	header.latitude_ascending = fields.latitude_ascending ? 1 : 0;
+	header.key = key;
+
+	const char* arrays[cache_num_arrays] = {
+		(const char*)fields.pressure->GetSurfacePressure().data(),
+		(const char*)fields.pressure->GetA().data(),
+		(const char*)fields.pressure->GetB().data(),
+		(const char*)fields.wind_direction_normalized->GetData().data(),
+		(const char*)fields.wind_magnitude->GetData().data(),
+		(const char*)fields.wind_magnitude_smooth->GetData().data(),
+		(const char*)fields.grad_wind_magnitude->GetData().data() };
+	header.sizes[0] = fields.pressure->GetSurfacePressure().size() * sizeof(float);
+	header.sizes[1] = fields.pressure->GetA().size() * sizeof(float);
+	header.sizes[2] = fields.pressure->GetB().size() * sizeof(float);
+	header.sizes[3] = fields.wind_direction_normalized->GetData().size() * sizeof(Vec3f);
+	header.sizes[4] = fields.wind_magnitude->GetData().size() * sizeof(float);
+	header.sizes[5] = fields.wind_magnitude_smooth->GetData().size() * sizeof(float);
+	header.sizes[6] = fields.grad_wind_magnitude->GetData().size() * sizeof(Vec3f);
+	uint64_t offset = sizeof(CacheHeader);
+	for (int i = 0; i < cache_num_arrays; i++) {
+		offset = (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+		header.offsets[i] = offset;
+		offset += header.sizes[i];
+	}
+
+	// Write to a temporary file first, such that a concurrent or interrupted run never sees a partial cache file.
+	std::string tmp_path = path + ".tmp";
+	std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+	if (!file) return false;
+	file.write((const char*)&header, sizeof(CacheHeader));
+	uint64_t position = sizeof(CacheHeader);
+	const char padding[cache_alignment] = { 0 };
+	for (int i = 0; i < cache_num_arrays; i++) {
+		file.write(padding, header.offsets[i] - position);
+		file.write(arrays[i], header.sizes[i]);
+		position = header.offsets[i] + header.sizes[i];
+	}
+	file.close();
+	if (!file) {
+		std::remove(tmp_path.c_str());
+		return false;
+	}
+	std::error_code error;
+	std::filesystem::rename(tmp_path, path, error);
+	return !error;
+}
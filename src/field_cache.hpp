@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <string>
+
+#include "data_catalog.hpp"
+#include "hybrid_pressure.hpp"
+#include "regular_grid.hpp"
+
+class FieldCache
+{
+	/*
+		Binary on-disk cache of the derived fields of a time step: the vertical coordinate (surface pressure and hybrid coefficients), the normalized wind direction, the wind magnitude,
+		the smoothed wind magnitude and its gradient. Reruns with different tracing parameters read the cache instead of loading the source file
+		and recomputing the fields.
+		File layout: a fixed size header followed by the raw field arrays in the order above. Every array starts at a multiple of 64 bytes,
+		such that the file can be memory mapped and each array is read with a single copy.
+	*/
+public:
+	/*
+		Parameters which change the derived fields. A cache file is only used if they match.
+	*/
+	struct Key {
+		int32_t load_level_range = 0;
+		double ps_min_tracing = 0;
+		double ps_max_tracing = 0;
+	};
+
+	struct Fields {
+		HybridPressure* pressure = nullptr;
+		RegVectorField3f* wind_direction_normalized = nullptr;
+		RegScalarField3f* wind_magnitude = nullptr;
+		RegScalarField3f* wind_magnitude_smooth = nullptr;
+		RegVectorField3f* grad_wind_magnitude = nullptr;
+		// Whether the latitude index runs from south to north, see DataHelper::IsLatitudeAscending.
+		bool latitude_ascending = true;
+	};
+
+	// Returns the path of the cache file of the time step in the preprocessing directory.
+	static std::string GetPath(const DataCatalog& catalog, const size_t& time);
+
+	// Reads the fields if the cache file exists, matches the key and is newer than the source file. Returns false otherwise.
+	static bool Read(const std::string& path, const std::string& source_path, const Key& key, Fields& fields);
+	// Writes the fields to the cache file. The file is replaced atomically.
+	static bool Write(const std::string& path, const Key& key, const Fields& fields);
+};
@@ -1,4 +1,8 @@
 ﻿#pragma once
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "grid_iteration.hpp"
 #include "regular_grid.hpp"
 
 class Gradient
@@ -11,8 +15,6 @@ public:
 	*/
 	Vec3f GradientAtGridCoord(const Vec3i& coord, RegScalarField3f* field, RegScalarField3f* temp) const {
 		Vec3i clamped_grid_coords = ClampToPeriodicSphereGrid(coord, field->GetResolution());
-		Vec3d domain_coords = field->GetCoordAtWithInvertedZDomain(clamped_grid_coords);
-		Vec2f domain_coords_in_m = GetWorldLengthOfDegreeInMeters(domain_coords[1]);
 		Vec3f step_sizes = field->GetVoxelSize();
 
 		Vec3f gradient;
@@ -43,17 +45,15 @@ public:
 			Vec3i grid_coord_lev_minus = clamped_grid_coords;
 			float vertex_data_lev_plus = field->GetVertexDataAt(grid_coord_lev_plus);
 			float vertex_data_lev_minus = field->GetVertexDataAt(grid_coord_lev_minus);
-			float size_of_1hpa_in_m = ConvertPaToM(100, temp->GetVertexDataAt(grid_coord_lev_minus), 1010.f - grid_coord_lev_minus[2] * 10.f);
 			gradient[2] = (vertex_data_lev_plus - vertex_data_lev_minus) / (step_sizes[2]);
 
 		}
-		else if (clamped_grid_coords[2] == field->GetResolution()[1] - 1) {
+		else if (clamped_grid_coords[2] == field->GetResolution()[2] - 1) {
 			//Downward differeintiation
 			Vec3i grid_coord_lev_plus = clamped_grid_coords;
 			Vec3i grid_coord_lev_minus = ClampToPeriodicSphereGrid(clamped_grid_coords + Vec3i({ 0,0,-1 }), field->GetResolution());
 			float vertex_ata_lev_plus = field->GetVertexDataAt(grid_coord_lev_plus);
 			float vertex_data_lev_minus = field->GetVertexDataAt(grid_coord_lev_minus);
-			float size_of_1hpa_in_m = ConvertPaToM(100, temp->GetVertexDataAt(grid_coord_lev_minus), 1010.f - grid_coord_lev_minus[2] * 10.f);
 			gradient[2] = (vertex_ata_lev_plus - vertex_data_lev_minus) / (step_sizes[2]);
 
 		}
@@ -63,38 +63,104 @@ public:
 			Vec3i grid_coord_lev_minus = ClampToPeriodicSphereGrid(clamped_grid_coords + Vec3i({ 0,0,-1 }), field->GetResolution());
 			float vertex_ata_lev_plus = field->GetVertexDataAt(grid_coord_lev_plus);
 			float vertex_data_lev_minus = field->GetVertexDataAt(grid_coord_lev_minus);
-			float size_of_1hpa_in_m = ConvertPaToM(100, temp->GetVertexDataAt(grid_coord_lev_minus), 1010.f - grid_coord_lev_minus[2] * 10.f);
 			gradient[2] = (vertex_ata_lev_plus - vertex_data_lev_minus) / (2.f * step_sizes[2]);
 
 		}
 		return gradient;
 	}
 	/*
-		Computes the gradient of the source_field and returns it as Vector Field.
+		Computes the gradient of the source_field and returns it as Vector Field. Gives the same result as GradientAtGridCoord for every vertex.
+		The field is processed row by row along the longitude. The interior of a row uses contiguous loads and is vectorized,
+		the two vertices at the longitude seam wrap around. Pole rows are 0. The level neighbors and divisors are tabulated per level,
+		which covers the one-sided differences at the bottom and top levels. The components are computed into separate arrays and interleaved afterwards.
 	*/
 	RegVectorField3f* GradientVectorField(RegScalarField3f* source_field, RegScalarField3f* temp) const {
-		RegVectorField3f* gradient = new RegVectorField3f(Vec3i({ source_field->GetResolution()[0], source_field->GetResolution()[1], source_field->GetResolution()[2] }), source_field->GetDomain());
-		size_t num_entries = (size_t)gradient->GetResolution()[0] * (size_t)gradient->GetResolution()[1] * (size_t)gradient->GetResolution()[2];
-
-#pragma omp parallel for schedule(dynamic,16)
-		for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-			Vec3i coords = gradient->GetGridCoord(linear_index);
-			gradient->SetVertexDataAt(coords, GradientAtGridCoord(coords, source_field, temp));
+		const Vec3i res = source_field->GetResolution();
+		RegVectorField3f* gradient = new RegVectorField3f(res, source_field->GetDomain());
+		const int nx = res[0];
+		const int ny = res[1];
+		const int nz = res[2];
+		const Vec3f step_sizes = source_field->GetVoxelSize();
+		const float divisor_x = 2.f * step_sizes[0];
+		const float divisor_y = 2.f * step_sizes[1];
+
+		std::vector<int> level_plus(nz), level_minus(nz);
+		std::vector<float> divisor_z(nz);
+		for (int k = 0; k < nz; k++) {
+			if (k == 0) {
+				level_plus[k] = std::min(1, nz - 1);
+				level_minus[k] = 0;
+				divisor_z[k] = step_sizes[2];
+			}
+			else if (k == nz - 1) {
+				level_plus[k] = k;
+				level_minus[k] = k - 1;
+				divisor_z[k] = step_sizes[2];
+			}
+			else {
+				level_plus[k] = std::min(k + 1, nz - 1);
+				level_minus[k] = k - 1;
+				divisor_z[k] = 2.f * step_sizes[2];
+			}
 		}
+
+		// The component arrays are allocated once per thread and reused for all its rows.
+#ifdef _OPENMP
+		std::vector<std::vector<float>> thread_components(omp_get_max_threads());
+#else
+		std::vector<std::vector<float>> thread_components(1);
+#endif
+		GridStencil<float> stencil(*source_field);
+		Vec3f* gradient_data = gradient->GetData().data();
+		ForEachRow(res, [&](const int& j, const int& k, const int64_t& row_index) {
+			Vec3f* out = gradient_data + row_index;
+			if (j == 0 || j == ny - 1) {
+				for (int i = 0; i < nx; i++) {
+					out[i] = Vec3f({ 0, 0, 0 });
+				}
+				return;
+			}
+			const float* center = stencil.Row(j, k);
+			const float* north = stencil.Row(j + 1, k);
+			const float* south = stencil.Row(j - 1, k);
+			const float* above = stencil.Row(j, level_plus[k]);
+			const float* below = stencil.Row(j, level_minus[k]);
+			const float dz = divisor_z[k];
+
+#ifdef _OPENMP
+			std::vector<float>& components = thread_components[omp_get_thread_num()];
+#else
+			std::vector<float>& components = thread_components[0];
+#endif
+			components.resize(3 * (size_t)nx);
+			float* gx = components.data();
+			float* gy = gx + nx;
+			float* gz = gy + nx;
+			for (int i = 1; i < nx - 1; i++) {
+				gx[i] = (center[i + 1] - center[i - 1]) / divisor_x;
+			}
+			gx[0] = (center[1 % nx] - center[nx - 1]) / divisor_x;
+			gx[nx - 1] = (center[0] - center[(nx - 2 + nx) % nx]) / divisor_x;
+			for (int i = 0; i < nx; i++) {
+				gy[i] = (north[i] - south[i]) / divisor_y;
+				gz[i] = (above[i] - below[i]) / dz;
+			}
+			for (int i = 0; i < nx; i++) {
+				out[i] = Vec3f({ gx[i], gy[i], gz[i] });
+			}
+		});
 		return gradient;
 	}
 	/*
 		Computes the normalized gradient of the source_field and returns it as Vector Field.
 	*/
 	RegVectorField3f* NormalizedGradientVectorField(RegScalarField3f* source_field, RegScalarField3f* temp) const {
-		RegVectorField3f* gradient = new RegVectorField3f(Vec3i({ source_field->GetResolution()[0], source_field->GetResolution()[1], source_field->GetResolution()[2] }), source_field->GetDomain());
-		size_t num_entries = (size_t)gradient->GetResolution()[0] * (size_t)gradient->GetResolution()[1] * (size_t)gradient->GetResolution()[2];
-#pragma omp parallel for schedule(dynamic,16)
-		for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-			Vec3i coords = gradient->GetGridCoord(linear_index);
-			Vec3f local_grad = GradientAtGridCoord(coords, source_field, temp);
-			gradient->SetVertexDataAt(coords, local_grad / local_grad.length());
-		}
+		RegVectorField3f* gradient = new RegVectorField3f(source_field->GetResolution(), source_field->GetDomain());
+		Vec3f* gradient_data = gradient->GetData().data();
+		ForEachVoxel(gradient->GetResolution(), [&](const int& i, const int& j, const int& k, const int64_t& linear_index) {
+			Vec3f local_grad = GradientAtGridCoord(Vec3i({ i, j, k }), source_field, temp);
+			gradient_data[linear_index] = local_grad / local_grad.length();
+		});
 		return gradient;
 	}
 
@@ -102,16 +168,12 @@ public:
 		Computes the magnitude of the gradient of the source_field. Uses the l1 norm.
 	*/
 	RegScalarField3f* GradientMagnitude(RegScalarField3f* source_field, RegScalarField3f* temp) const {
-		RegScalarField3f* mag = new RegScalarField3f(Vec3i({ source_field->GetResolution()[0], source_field->GetResolution()[1], source_field->GetResolution()[2] }), source_field->GetDomain());
-		size_t num_entries = (size_t)mag->GetResolution()[0] * (size_t)mag->GetResolution()[1] * (size_t)mag->GetResolution()[2];
-#ifdef NDEBUG
-#pragma omp parallel for schedule(dynamic,16)
-#endif
-		for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-			Vec3i coords = mag->GetGridCoord(linear_index);
-			Vec3f local_grad = GradientAtGridCoord(coords, source_field, temp);
-			mag->SetVertexDataAt(coords, local_grad.length());
-		}
+		RegScalarField3f* mag = new RegScalarField3f(source_field->GetResolution(), source_field->GetDomain());
+		float* mag_data = mag->GetData().data();
+		ForEachVoxel(mag->GetResolution(), [&](const int& i, const int& j, const int& k, const int64_t& linear_index) {
+			Vec3f local_grad = GradientAtGridCoord(Vec3i({ i, j, k }), source_field, temp);
+			mag_data[linear_index] = local_grad.length();
+		});
 		return mag;
 	}
 
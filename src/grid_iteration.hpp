@@ -0,0 +1,81 @@
+﻿#pragma once
+#include "regular_grid.hpp"
+
+/*
+	Loops over the voxels of 3D regular grids without per-voxel index arithmetic.
+	The rows along x are contiguous in memory. The rows of the box [begin, end) are split into tiles of grid_tile_rows neighboring rows
+	within one level, which are distributed statically over the OpenMP threads. Neighboring rows of a stencil are then mostly handled by the same thread.
+*/
+static const int grid_tile_rows = 8;
+
+/*
+	Calls kernel(j, k, row_index) for every row (j, k) of the box [begin, end) in a grid with resolution res.
+	row_index is the linear index of the vertex (0, j, k).
+*/
+template<typename TKernel>
+void ForEachRow(const Vec3i& res, const Vec3i& begin, const Vec3i& end, const TKernel& kernel) {
+	const int n_rows = end[1] - begin[1];
+	const int n_levels = end[2] - begin[2];
+	if (n_rows <= 0 || n_levels <= 0 || end[0] <= begin[0]) return;
+	const int n_tiles_per_level = (n_rows + grid_tile_rows - 1) / grid_tile_rows;
+
+#pragma omp parallel for schedule(static)
+	for (int64_t tile = 0; tile < (int64_t)n_tiles_per_level * n_levels; tile++) {
+		const int k = begin[2] + (int)(tile / n_tiles_per_level);
+		const int j_begin = begin[1] + (int)(tile % n_tiles_per_level) * grid_tile_rows;
+		const int j_end = std::min(j_begin + grid_tile_rows, end[1]);
+		for (int j = j_begin; j < j_end; j++) {
+			kernel(j, k, ((int64_t)k * res[1] + j) * res[0]);
+		}
+	}
+}
+
+template<typename TKernel>
+void ForEachRow(const Vec3i& res, const TKernel& kernel) {
+	ForEachRow(res, Vec3i({ 0, 0, 0 }), res, kernel);
+}
+
+/*
+	Calls kernel(i, j, k, linear_index) for every voxel (i, j, k) of the box [begin, end) in a grid with resolution res.
+*/
+template<typename TKernel>
+void ForEachVoxel(const Vec3i& res, const Vec3i& begin, const Vec3i& end, const TKernel& kernel) {
+	const int i_begin = begin[0];
+	const int i_end = end[0];
+	ForEachRow(res, begin, end, [&](const int& j, const int& k, const int64_t& row_index) {
+		for (int i = i_begin; i < i_end; i++) {
+			kernel(i, j, k, row_index + i);
+		}
+	});
+}
+
+template<typename TKernel>
+void ForEachVoxel(const Vec3i& res, const TKernel& kernel) {
+	ForEachVoxel(res, Vec3i({ 0, 0, 0 }), res, kernel);
+}
+
+/*
+	Direct access to the rows of a grid for stencil kernels. Row(j, k) points to the vertex (0, j, k).
+	The caller is responsible for keeping j and k inside the grid.
+*/
+template<typename TValueType>
+class GridStencil
+{
+public:
+	GridStencil(const RegularGrid<TValueType, 3>& grid) :
+		data_(grid.GetData().data()),
+		res_(grid.GetResolution()),
+		slice_size_((int64_t)grid.GetResolution()[0] * grid.GetResolution()[1])
+	{
+	}
+
+	const TValueType* Row(const int& j, const int& k) const {
+		return data_ + k * slice_size_ + (int64_t)j * res_[0];
+	}
+	const Vec3i& GetResolution() const { return res_; }
+
+private:
+	const TValueType* data_;
+	Vec3i res_;
+	int64_t slice_size_;
+};
@@ -0,0 +1,91 @@
+﻿#pragma once
+#include <vector>
+
+#include "math.hpp"
+
+/*
+	The vertical coordinate of the model levels: the pressure of level k in the column (i, j) is a(k) + b(k) * PS(i, j) in hPa,
+	with the hybrid coefficients a = hyam / 100 and b = hybm of the loaded levels. Only the 2D surface pressure and the two 1D coefficient
+	arrays are stored, the 3D pressure is computed where it is needed.
+*/
+class HybridPressure
+{
+public:
+	/*
+		resolution is the resolution of the 3D fields on the model levels. surface_pressure has resolution[0] * resolution[1] values with x fastest,
+		a and b have resolution[2] values.
+	*/
+	HybridPressure(const Vec3i& resolution, const std::vector<float>& surface_pressure, const std::vector<float>& a, const std::vector<float>& b) :
+		resolution_(resolution),
+		surface_pressure_(surface_pressure),
+		a_(a),
+		b_(b)
+	{
+	}
+
+	const Vec3i& GetResolution() const { return resolution_; }
+	const std::vector<float>& GetSurfacePressure() const { return surface_pressure_; }
+	const std::vector<float>& GetA() const { return a_; }
+	const std::vector<float>& GetB() const { return b_; }
+
+	float GetSurfacePressure(const int& i, const int& j) const {
+		return surface_pressure_[(size_t)j * resolution_[0] + i];
+	}
+	// Returns the pressure of level k in a column with the given surface pressure.
+	float GetLevelPressure(const int& k, const float& surface_pressure) const {
+		return a_[k] + b_[k] * surface_pressure;
+	}
+	float GetPressure(const int& i, const int& j, const int& k) const {
+		return GetLevelPressure(k, GetSurfacePressure(i, j));
+	}
+
+	/*
+		Returns the fractional level k, where the pressure is equal to searched_ps at the grid coordinates (i,j).
+		Inverts the level relation of the column by bisection over the coefficients, which only loads the surface pressure of the column.
+	*/
+	double FindLevel(const int& i, const int& j, const double& searched_ps) const {
+		const float surface_pressure = GetSurfacePressure(i, j);
+		double level = 0.;
+		int l = 0;
+		int r = resolution_[2] - 1;
+		//Border Cases: if there is no pressure p at position (i,j) with min_p <= p <= max_p where min_p and max_p are the smallest and largest value in this column
+		//we set level to 0 or to the max level.
+		if (searched_ps <= GetLevelPressure(0, surface_pressure)) {
+			level = 0.0;
+		}
+		else if (searched_ps >= GetLevelPressure(r, surface_pressure)) {
+			level = r;
+		}
+		else {
+			//Binary search with integrated linear interpolation
+			while (l < r) {
+				int m = l + (r - l) / 2;
+				float ps_atm = GetLevelPressure(m, surface_pressure);
+				if (ps_atm == searched_ps) {
+					level = m;
+					break;
+				}
+				if (l + 1 == r) {
+					double psl = (double)GetLevelPressure(l, surface_pressure);
+					double psr = (double)GetLevelPressure(r, surface_pressure);
+
+					level = l + ((searched_ps - psl) / (psr - psl));
+					break;
+				}
+				if (ps_atm < searched_ps) {
+					l = m;
+				}
+				else {
+					r = m;
+				}
+			}
+		}
+		return level;
+	}
+
+private:
+	Vec3i resolution_;
+	std::vector<float> surface_pressure_;
+	std::vector<float> a_;
+	std::vector<float> b_;
+};
@@ -2,9 +2,8 @@
 #include <filesystem>
 #include <string>
 
-#include "data_helper.hpp"
-#include "time_helper.hpp"
-#include "jet_stream.hpp"
+#include "data_catalog.hpp"
+#include "jet_pipeline.hpp"
 #include "progress_bar.hpp"
 
 std::string ConvertPath(std::string path) {
@@ -29,6 +28,7 @@ int main(int argc, char* argv[])
     bool dst_found = false;
     bool recompute = false;
     bool export_txt = false;
+    size_t n_parallel_time_steps = 1;
     JetStream::JetParameters jet_params;
 
     for (int i = 1; i < argc; i++) {
@@ -96,6 +96,126 @@ int main(int argc, char* argv[])
                 std::cout << "Not enough arguments." << std::endl;
             }
         }
+        else if (arg == "-adaptiveStepsize") {
+            jet_params.adaptive_stepsize = true;
+        }
+        else if (arg == "-adaptiveTolerance") {
+            i++;
+            if (i < argc) {
+                jet_params.adaptive_tolerance = atof(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-minStepsize") {
+            i++;
+            if (i < argc) {
+                jet_params.min_stepsize = atof(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-maxStepsize") {
+            i++;
+            if (i < argc) {
+                jet_params.max_stepsize = atof(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-maxVertexSpacing") {
+            i++;
+            if (i < argc) {
+                jet_params.max_vertex_spacing = atof(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-corrector") {
+            i++;
+            if (i < argc) {
+                std::string corrector = std::string(argv[i]);
+                if (corrector == "rk4") {
+                    jet_params.corrector = JetStream::CORRECTOR::RK4;
+                }
+                else if (corrector == "converged") {
+                    jet_params.corrector = JetStream::CORRECTOR::CONVERGED;
+                }
+                else if (corrector == "newton") {
+                    jet_params.corrector = JetStream::CORRECTOR::NEWTON;
+                }
+                else {
+                    std::cout << "Unknown corrector " << corrector << "." << std::endl;
+                }
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-correctorTolerance") {
+            i++;
+            if (i < argc) {
+                jet_params.corrector_tolerance = atof(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-hemisphere") {
+            i++;
+            if (i < argc) {
+                std::string hemisphere = std::string(argv[i]);
+                if (hemisphere == "both") {
+                    jet_params.hemisphere = JetStream::HEMISPHERE::BOTH;
+                }
+                else if (hemisphere == "north") {
+                    jet_params.hemisphere = JetStream::HEMISPHERE::NORTH;
+                }
+                else if (hemisphere == "south") {
+                    jet_params.hemisphere = JetStream::HEMISPHERE::SOUTH;
+                }
+                else {
+                    std::cout << "Unknown hemisphere " << hemisphere << "." << std::endl;
+                }
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-temporalTracking") {
+            jet_params.temporal_tracking = true;
+        }
+        else if (arg == "-trackingCorrectorSteps") {
+            i++;
+            if (i < argc) {
+                jet_params.tracking_corrector_steps = atoi(argv[i]);
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-loadLevelRange") {
+            jet_params.load_level_range = true;
+        }
+        else if (arg == "-parallelTimeSteps") {
+            i++;
+            if (i < argc) {
+                n_parallel_time_steps = (size_t)std::max(1, atoi(argv[i]));
+            }
+            else {
+                std::cout << "Not enough arguments." << std::endl;
+            }
+        }
+        else if (arg == "-resampleToPsAxis") {
+            jet_params.resample_to_ps_axis = true;
+        }
+        else if (arg == "-cacheFields") {
+            jet_params.use_field_cache = true;
+        }
         else if (arg == "-exportTxt") {
             export_txt = true;
         }
@@ -138,21 +258,18 @@ int main(int argc, char* argv[])
     src_path = ConvertPath(src_path);
     dst_path = ConvertPath(dst_path);
 
-    std::ofstream settingsFile;
-    settingsFile.open("settings.txt");
-    settingsFile << "SourceDirectory=" << src_path << "\n";
-    settingsFile << "DestDirectory=" << dst_path << "\n";
-    settingsFile.close();
-
     if (!std::filesystem::exists(dst_path)) {
         std::filesystem::create_directory(dst_path);
     }
 
-    std::vector<std::string> time_steps = DataHelper::CollectTimes();
-    std::string data_start_date = DataHelper::GetDataStartDate();
+    DataCatalog catalog(src_path, dst_path);
+    const std::vector<std::string>& time_steps = catalog.GetTimeSteps();
+    if (time_steps.size() == 0) {
+        std::cout << "No Data found" << std::endl;
+        return 0;
+    }
     ProgressBar pb(time_steps.size());
-    JetStream* previous_jet = nullptr;
-    std::vector<float> ps_axis = DataHelper::GetPsAxis();
+    std::vector<JetPipeline::Task> tasks;
     for (const auto& time_step : time_steps)
     {
         std::string jet_name;
@@ -165,32 +282,23 @@ int main(int argc, char* argv[])
         }
 
         if (!recompute && std::filesystem::exists(jet_name)) { pb.Print(); continue; }
-        size_t hours = TimeHelper::ConvertDateToHours(time_step, data_start_date);
-        JetStream* jet_stream = new JetStream(hours, jet_params, false);
+        size_t hours = catalog.GetHours(time_step);
+        tasks.push_back(JetPipeline::Task{ hours, jet_name });
+    }
 
-        if (previous_jet != nullptr && previous_jet->GetTime() == hours - 1)
-        {
-            jet_stream->SetPreviousJet(previous_jet);
-        }
-        const LineCollection& jet = jet_stream->GetJetCoreLines();
-        if (export_txt)
-        {
-            jet.ExportTxtFile(jet_name.c_str(), ps_axis);
-        }
-        else
-        {
-            jet.ExportVtp(jet_name.c_str(), ps_axis);
-        }
+    JetPipeline pipeline(catalog, jet_params, export_txt, n_parallel_time_steps);
+    pipeline.Run(tasks, pb);
 
-        jet_stream->DeletePreviousJet();
-        previous_jet = jet_stream;
+    pb.Close();
 
-        pb.Print();
+    const JetStream::ResamplingDifference& difference = pipeline.GetResamplingDifference();
+    if (jet_params.resample_to_ps_axis && difference.count > 0) {
+        std::cout << "Difference of the resampled wind magnitude: max " << difference.max << " m/s, mean " << difference.sum / difference.count << " m/s" << std::endl;
+    }
+    const JetStream::CorrectorStatistics& statistics = pipeline.GetCorrectorStatistics();
+    if (jet_params.corrector != JetStream::CORRECTOR::RK4 && statistics.corrections > 0) {
+        std::cout << "Corrector steps: " << statistics.steps << " in " << statistics.corrections << " corrections, mean " << (double)statistics.steps / statistics.corrections << std::endl;
     }
-    delete previous_jet;
-    previous_jet = nullptr;
-
-    pb.Close();
 
     return 0;
 }
@@ -0,0 +1,174 @@
+﻿#include <thread>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "data_helper.hpp"
+
+#include "jet_pipeline.hpp"
+
+/*
+	Deriving and tracing run OpenMP loops concurrently, so each of their n_threads threads gets an equal share of the cores.
+*/
+static void ShareCores(const int& n_threads) {
+#ifdef _OPENMP
+	omp_set_num_threads(std::max(1, omp_get_num_procs() / n_threads));
+#endif
+}
+
+/*
+	Besides the time steps which are derived and traced, one more time step is loaded ahead.
+*/
+JetPipeline::JetPipeline(const DataCatalog& catalog, const JetStream::JetParameters& jet_params, const bool& export_txt, const size_t& n_parallel_time_steps)
+	:catalog_(catalog),
+	jet_params_(jet_params),
+	export_txt_(export_txt),
+	n_parallel_time_steps_(std::max(n_parallel_time_steps, (size_t)1)),
+	max_time_steps_in_flight_(2 * std::max(n_parallel_time_steps, (size_t)1) + 1),
+	ps_axis_values_(DataHelper::GetPsAxis()),
+	time_steps_in_flight_(0),
+	next_chain_(0)
+{
+}
+
+/*
+	Processes the tasks, which have to be sorted by time. Loading and writing run in one thread each, deriving and tracing in n_parallel_time_steps threads each.
+*/
+void JetPipeline::Run(const std::vector<Task>& tasks, ProgressBar& progress_bar) {
+	std::vector<std::vector<size_t>> chains = SplitIntoChains(tasks);
+	derived_.clear();
+	time_steps_in_flight_ = 0;
+	next_chain_ = 0;
+	resampling_difference_ = JetStream::ResamplingDifference();
+	corrector_statistics_ = JetStream::CorrectorStatistics();
+
+	BoundedQueue<LoadedTimeStep> loaded(1);
+	BoundedQueue<TracedTimeStep> traced(n_parallel_time_steps_);
+
+	std::thread loader(&JetPipeline::Load, this, std::cref(tasks), std::ref(loaded));
+	std::vector<std::thread> derivers;
+	std::vector<std::thread> tracers;
+	for (size_t i = 0; i < n_parallel_time_steps_; i++) {
+		derivers.push_back(std::thread(&JetPipeline::Derive, this, std::ref(loaded)));
+		tracers.push_back(std::thread(&JetPipeline::Trace, this, std::cref(tasks), std::cref(chains), std::ref(traced)));
+	}
+	std::thread writer(&JetPipeline::Write, this, std::ref(traced), std::ref(progress_bar));
+
+	loader.join();
+	for (size_t i = 0; i < n_parallel_time_steps_; i++) {
+		derivers[i].join();
+		tracers[i].join();
+	}
+	traced.Close();
+	writer.join();
+}
+
+/*
+	Splits the task indices into chains of consecutive hours.
+*/
+std::vector<std::vector<size_t>> JetPipeline::SplitIntoChains(const std::vector<Task>& tasks) {
+	std::vector<std::vector<size_t>> chains;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (i == 0 || tasks[i].time != tasks[i - 1].time + 1) {
+			chains.push_back(std::vector<size_t>());
+		}
+		chains.back().push_back(i);
+	}
+	return chains;
+}
+
+/*
+	Loads the tasks in order. Loading in order guarantees that the earliest unfinished chain can always make progress, such that bounding the
+	number of time steps in flight can't block the pipeline.
+*/
+void JetPipeline::Load(const std::vector<Task>& tasks, BoundedQueue<LoadedTimeStep>& output) {
+	for (size_t i = 0; i < tasks.size(); i++) {
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			in_flight_changed_.wait(lock, [this] { return time_steps_in_flight_ < max_time_steps_in_flight_; });
+			time_steps_in_flight_++;
+		}
+		output.Push(LoadedTimeStep{ i, JetStream::LoadSourceFields(tasks[i].time, catalog_, jet_params_) });
+	}
+	output.Close();
+}
+
+/*
+	The derivers and the tracers share the cores for their OpenMP loops.
+*/
+void JetPipeline::Derive(BoundedQueue<LoadedTimeStep>& input) {
+	ShareCores(2 * (int)n_parallel_time_steps_);
+	LoadedTimeStep loaded;
+	while (input.Pop(loaded)) {
+		JetStream* jet_stream = new JetStream(loaded.source_fields, catalog_, jet_params_);
+		std::lock_guard<std::mutex> lock(mtx_);
+		const JetStream::ResamplingDifference& difference = jet_stream->GetResamplingDifference();
+		resampling_difference_.max = std::max(resampling_difference_.max, difference.max);
+		resampling_difference_.sum += difference.sum;
+		resampling_difference_.count += difference.count;
+		derived_[loaded.task_index] = jet_stream;
+		derived_changed_.notify_all();
+	}
+}
+
+JetStream* JetPipeline::WaitForDerived(const size_t& task_index) {
+	std::unique_lock<std::mutex> lock(mtx_);
+	derived_changed_.wait(lock, [this, &task_index] { return derived_.count(task_index) != 0; });
+	JetStream* jet_stream = derived_[task_index];
+	derived_.erase(task_index);
+	return jet_stream;
+}
+
+/*
+	Takes the next untraced chain and traces its time steps in order. The jet of the previous time step is kept until the current one is traced,
+	because its core lines seed the current jet.
+*/
+void JetPipeline::Trace(const std::vector<Task>& tasks, const std::vector<std::vector<size_t>>& chains, BoundedQueue<TracedTimeStep>& output) {
+	ShareCores(2 * (int)n_parallel_time_steps_);
+	while (true) {
+		size_t chain;
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (next_chain_ >= chains.size()) {
+				return;
+			}
+			chain = next_chain_++;
+		}
+
+		JetStream* previous_jet = nullptr;
+		for (const size_t& task_index : chains[chain]) {
+			JetStream* jet_stream = WaitForDerived(task_index);
+			if (previous_jet != nullptr) {
+				jet_stream->SetPreviousJet(previous_jet);
+			}
+			output.Push(TracedTimeStep{ tasks[task_index], jet_stream->GetJetCoreLines() });
+
+			jet_stream->DeletePreviousJet();
+			previous_jet = jet_stream;
+			{
+				std::lock_guard<std::mutex> lock(mtx_);
+				const JetStream::CorrectorStatistics& statistics = jet_stream->GetCorrectorStatistics();
+				corrector_statistics_.corrections += statistics.corrections;
+				corrector_statistics_.steps += statistics.steps;
+				time_steps_in_flight_--;
+				in_flight_changed_.notify_all();
+			}
+		}
+		delete previous_jet;
+	}
+}
+
+void JetPipeline::Write(BoundedQueue<TracedTimeStep>& input, ProgressBar& progress_bar) {
+	TracedTimeStep traced;
+	while (input.Pop(traced)) {
+		if (export_txt_)
+		{
+			traced.jet.ExportTxtFile(traced.task.output_path.c_str(), ps_axis_values_);
+		}
+		else
+		{
+			traced.jet.ExportVtp(traced.task.output_path.c_str(), ps_axis_values_);
+		}
+		progress_bar.Print();
+	}
+}
@@ -0,0 +1,75 @@
+﻿#pragma once
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "bounded_queue.hpp"
+#include "jet_stream.hpp"
+#include "progress_bar.hpp"
+
+class JetPipeline
+{
+	/*
+		Computes the jet core lines of a sequence of time steps in a pipeline with four stages: loading the source fields, deriving the wind fields,
+		tracing the core lines and exporting them. The stages run concurrently, such that source files are read while other time steps are traced.
+
+		The only dependency between time steps is the seeding of a jet with the core lines of the previous hour. The tasks are therefore split into
+		chains of consecutive hours. Within a chain, the time steps are traced in order, independent chains are traced concurrently.
+		The wind fields of several time steps are derived concurrently, because they don't depend on each other.
+		The number of time steps which are loaded but not yet traced is bounded, which limits the memory use.
+	*/
+public:
+	struct Task {
+		size_t time;
+		std::string output_path;
+	};
+
+	/*
+		n_parallel_time_steps is the number of time steps which are derived and the number of chains which are traced concurrently.
+	*/
+	JetPipeline(const DataCatalog& catalog, const JetStream::JetParameters& jet_params, const bool& export_txt, const size_t& n_parallel_time_steps = 1);
+
+	void Run(const std::vector<Task>& tasks, ProgressBar& progress_bar);
+
+	// The resampling differences of all time steps of the last run, if the fields are resampled to the pressure axis.
+	const JetStream::ResamplingDifference& GetResamplingDifference() const { return resampling_difference_; }
+	// The corrector statistics of all time steps of the last run.
+	const JetStream::CorrectorStatistics& GetCorrectorStatistics() const { return corrector_statistics_; }
+
+private:
+	struct LoadedTimeStep {
+		size_t task_index;
+		JetStream::SourceFields source_fields;
+	};
+	struct TracedTimeStep {
+		Task task;
+		LineCollection jet;
+	};
+
+	const DataCatalog& catalog_;
+	const JetStream::JetParameters jet_params_;
+	const bool export_txt_;
+	const size_t n_parallel_time_steps_;
+	const size_t max_time_steps_in_flight_;
+	const std::vector<float> ps_axis_values_;
+
+	// Derived time steps by task index, which wait to be traced.
+	std::map<size_t, JetStream*> derived_;
+	size_t time_steps_in_flight_;
+	size_t next_chain_;
+	JetStream::ResamplingDifference resampling_difference_;
+	JetStream::CorrectorStatistics corrector_statistics_;
+	std::mutex mtx_;
+	std::condition_variable derived_changed_;
+	std::condition_variable in_flight_changed_;
+
+	static std::vector<std::vector<size_t>> SplitIntoChains(const std::vector<Task>& tasks);
+
+	void Load(const std::vector<Task>& tasks, BoundedQueue<LoadedTimeStep>& output);
+	void Derive(BoundedQueue<LoadedTimeStep>& input);
+	void Trace(const std::vector<Task>& tasks, const std::vector<std::vector<size_t>>& chains, BoundedQueue<TracedTimeStep>& output);
+	void Write(BoundedQueue<TracedTimeStep>& input, ProgressBar& progress_bar);
+
+	JetStream* WaitForDerived(const size_t& task_index);
+};
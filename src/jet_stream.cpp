@@ -1,39 +1,183 @@
 ﻿#include <mutex>
 #include <limits>
+#include <unordered_map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
+#include "grid_iteration.hpp"
 #include "wind_fields.hpp"
 #include "data_helper.hpp"
-#include "time_helper.hpp"
 
 #include "jet_stream.hpp"
 
-JetStream::JetStream(const size_t& time, const JetParameters& jet_params, const bool& ps3d_preprocessed)
-	:time_(time),
+/*
+	Number of seeds per thread in a batch of speculative traces, see FindJet. Most traces of a batch stop early or are not started,
+	so the batch has to reach past the seeds of the strongest jet to trace other jets in parallel.
+*/
+static const size_t speculative_seeds_per_thread = 64;
+
+/*
+	The new core lines of a time step get the ids time * line_ids_per_time_step, time * line_ids_per_time_step + 1, ..., with time the hours
+	since the first time step. The ids are thus unique in all outputs, also across the chains of time steps and across reruns.
+*/
+static const size_t line_ids_per_time_step = 100000;
+
+/*
+	Share of the vertices of a previous core line which its projection has to keep with temporal_tracking. The projection of a line which
+	moved by more than about a cell loses the vertices that leave the ridge and splits, such a line is traced again from the seeds instead.
+*/
+static const double min_projected_share = 0.9;
+
+/*
+	Stride of the vertices of a previous core line which are projected first, to skip the projection of the other vertices of the lines
+	that are retraced anyway.
+*/
+static const size_t projection_probe_stride = 16;
+
+JetStream::JetStream(const size_t& time, const DataCatalog& catalog, const JetParameters& jet_params)
+	:JetStream(LoadSourceFields(time, catalog, jet_params), catalog, jet_params)
+{
+}
+
+JetStream::JetStream(const SourceFields& source_fields, const DataCatalog& catalog, const JetParameters& jet_params)
+	:time_(source_fields.time),
 	jet_params_(jet_params),
-	ps3d_preprocessed_(ps3d_preprocessed),
 	ps_axis_values_(DataHelper::GetPsAxis()),
 	jet_core_lines_(LineCollection()),
-	fields_(std::vector<RegScalarField3f*>()),
+	fields_(source_fields.fields),
 	wind_direction_normalized_(nullptr),
 	grad_wind_magnitude_(nullptr),
 	wind_magnitude_(nullptr),
 	wind_magnitude_smooth_(nullptr),
-	ps3d_(nullptr),
+	pressure_(source_fields.pressure),
+	latitude_ascending_(source_fields.latitude_ascending),
+	era_locator_(source_fields.pressure),
+	trace_sampler_(nullptr),
+	resampled_trace_sampler_(nullptr),
+	wind_direction_resampled_(nullptr),
+	grad_wind_magnitude_resampled_(nullptr),
+	wind_magnitude_resampled_(nullptr),
+	next_line_id_(source_fields.time * line_ids_per_time_step),
 	mtx_(std::mutex()),
 	previous_jet_(nullptr)
 {
-	WindFields wind_fields;
+	const FieldCache::Fields& cached_fields = source_fields.cached_fields;
+	if (cached_fields.pressure != nullptr) {
+		wind_direction_normalized_ = new EraVectorField3f(cached_fields.wind_direction_normalized, pressure_);
+		wind_magnitude_ = new EraScalarField3f(cached_fields.wind_magnitude, pressure_);
+		wind_magnitude_smooth_ = new EraScalarField3f(cached_fields.wind_magnitude_smooth, pressure_);
+		grad_wind_magnitude_ = new EraVectorField3f(cached_fields.grad_wind_magnitude, pressure_);
+	}
+	else {
+		WindFields wind_fields;
+
+		wind_fields.GetWindDirectionAndMagnitudeEra(pressure_, fields_[0], fields_[1], fields_[2], fields_[3], wind_direction_normalized_, wind_magnitude_);
+		wind_magnitude_smooth_ = wind_fields.GetSmoothWindMagnitude(pressure_, wind_magnitude_->GetField());
+		grad_wind_magnitude_ = wind_fields.GetWindMagnitudeGradientEra(time_, pressure_, fields_[3], wind_magnitude_smooth_->GetField());
+
+		if (jet_params_.use_field_cache) {
+			FieldCache::Fields fields;
+			fields.pressure = pressure_;
+			fields.wind_direction_normalized = wind_direction_normalized_->GetField();
+			fields.wind_magnitude = wind_magnitude_->GetField();
+			fields.wind_magnitude_smooth = wind_magnitude_smooth_->GetField();
+			fields.grad_wind_magnitude = grad_wind_magnitude_->GetField();
+			fields.latitude_ascending = latitude_ascending_;
+			if (!FieldCache::Write(FieldCache::GetPath(catalog, time_), GetFieldCacheKey(jet_params_), fields)) {
+				std::cout << "Could not write the field cache of time step " << time_ << std::endl;
+			}
+		}
+	}
 
-	fields_ = DataHelper::LoadScalarFields(time_, std::vector<std::string>({ "U", "V", "OMEGA", "T" }));
-	ps3d_ = DataHelper::ComputePS3D(TimeHelper::ConvertHoursToDate(time_, DataHelper::GetDataStartDate()), fields_[0]->GetResolution(), fields_[0]->GetDomain());
-	wind_direction_normalized_ = wind_fields.GetNormalizedWindDirectionEra(time_, ps3d_, fields_[0], fields_[1], fields_[2]);
-	wind_magnitude_ = wind_fields.GetWindMagnitudeEra(time_, ps_axis_values_, ps3d_, fields_[0], fields_[1], fields_[2], fields_[3]);
-	wind_magnitude_smooth_ = wind_fields.GetSmoothWindMagnitude(time_, ps_axis_values_, ps3d_, fields_[0], fields_[1], fields_[2], fields_[3]);
-	grad_wind_magnitude_ = wind_fields.GetWindMagnitudeGradientEra(time_, ps3d_, fields_[3], wind_magnitude_smooth_->GetField());
+	trace_sampler_ = new TraceSampler(&era_locator_, wind_direction_normalized_, grad_wind_magnitude_, wind_magnitude_);
 
-	wind_magnitude_comparator_.ps_axis_values = ps_axis_values_;
-	wind_magnitude_comparator_.wind_magnitude = wind_magnitude_;
+	if (jet_params_.resample_to_ps_axis) {
+		ResampleToPressureAxis();
+	}
 }
+
+/*
+	Resamples the wind direction, the wind magnitude and its gradient onto the levels of the pressure axis, which lie in the tracing band
+	padded by one level. The tracing then samples them trilinearly instead of searching the level in each column.
+	Measures the difference of the wind magnitude to the sampling on the model levels.
+*/
+void JetStream::ResampleToPressureAxis() {
+	std::vector<float> band_axis;
+	for (const float& ps : ps_axis_values_) {
+		if (ps >= jet_params_.ps_min_tracing - 10 && ps <= jet_params_.ps_max_tracing + 10) {
+			band_axis.push_back(ps);
+		}
+	}
+	wind_direction_resampled_ = wind_direction_normalized_->ResampleToPressureAxis(band_axis);
+	grad_wind_magnitude_resampled_ = grad_wind_magnitude_->ResampleToPressureAxis(band_axis);
+	wind_magnitude_resampled_ = wind_magnitude_->ResampleToPressureAxis(band_axis);
+	resampled_trace_sampler_ = new ResampledTraceSampler(wind_magnitude_resampled_, wind_direction_resampled_, grad_wind_magnitude_resampled_, wind_magnitude_resampled_);
+
+	// Each thread accumulates the differences of its rows, the partial results are merged once.
+#ifdef _OPENMP
+	std::vector<ResamplingDifference> thread_differences(omp_get_max_threads());
+#else
+	std::vector<ResamplingDifference> thread_differences(1);
+#endif
+	const Vec3i& res = wind_magnitude_resampled_->GetResolution();
+	ForEachRow(res, Vec3i({ 0, 0, 0 }), res - Vec3i({ 1, 1, 1 }), [&](const int& j, const int& k, const int64_t&) {
+#ifdef _OPENMP
+		ResamplingDifference& difference = thread_differences[omp_get_thread_num()];
+#else
+		ResamplingDifference& difference = thread_differences[0];
+#endif
+		for (int i = 0; i < res[0] - 1; i++) {
+			Vec3d center = Vec3d({ i + 0.5, j + 0.5, (band_axis[k] + band_axis[k + 1ll]) / 2.0 });
+			double sample_difference = std::abs((double)wind_magnitude_resampled_->Sample(center) - (double)wind_magnitude_->Sample(center));
+			difference.max = std::max(difference.max, sample_difference);
+			difference.sum += sample_difference;
+		}
+		difference.count += res[0] - 1;
+	});
+	for (const ResamplingDifference& difference : thread_differences) {
+		resampling_difference_.max = std::max(resampling_difference_.max, difference.max);
+		resampling_difference_.sum += difference.sum;
+		resampling_difference_.count += difference.count;
+	}
+}
+
+/*
+	Reads U, V, OMEGA and T of the time step and the vertical coordinate of the loaded levels.
+	If the field cache is used and valid for the time step, the derived fields are read from the cache instead.
+*/
+JetStream::SourceFields JetStream::LoadSourceFields(const size_t& time, const DataCatalog& catalog, const JetParameters& jet_params) {
+	SourceFields source_fields;
+	source_fields.time = time;
+
+	std::string source_path = catalog.GetDataPath(time);
+	if (jet_params.use_field_cache && FieldCache::Read(FieldCache::GetPath(catalog, time), source_path, GetFieldCacheKey(jet_params), source_fields.cached_fields)) {
+		source_fields.pressure = source_fields.cached_fields.pressure;
+		source_fields.latitude_ascending = source_fields.cached_fields.latitude_ascending;
+		return source_fields;
+	}
+
+	NetCDF::File file(source_path);
+	Vec2i level_range = jet_params.load_level_range ? DataHelper::ComputeLevelRange(file, jet_params.ps_min_tracing, jet_params.ps_max_tracing) : DataHelper::GetLevelRange(file);
+	source_fields.fields = DataHelper::LoadScalarFields(file, std::vector<std::string>({ "U", "V", "OMEGA", "T" }), level_range);
+	source_fields.pressure = DataHelper::LoadHybridPressure(file, source_fields.fields[0]->GetResolution(), level_range[0]);
+	source_fields.latitude_ascending = DataHelper::IsLatitudeAscending(file);
+	return source_fields;
+}
+
+/*
+	The derived fields only depend on the loaded level range, not on the tracing parameters.
+*/
+FieldCache::Key JetStream::GetFieldCacheKey(const JetParameters& jet_params) {
+	FieldCache::Key key;
+	key.load_level_range = jet_params.load_level_range ? 1 : 0;
+	if (jet_params.load_level_range) {
+		key.ps_min_tracing = jet_params.ps_min_tracing;
+		key.ps_max_tracing = jet_params.ps_max_tracing;
+	}
+	return key;
+}
+
 JetStream::~JetStream() {
 	ps_axis_values_.clear();
 	for (size_t i = 0; i < fields_.size(); i++) {
@@ -48,10 +192,12 @@ JetStream::~JetStream() {
 	delete wind_magnitude_smooth_;
 	delete grad_wind_magnitude_->GetField();
 	delete grad_wind_magnitude_;
-	delete jet_kd_tree;
-	if (!ps3d_preprocessed_) {
-		delete ps3d_;
-	}
+	delete wind_direction_resampled_;
+	delete grad_wind_magnitude_resampled_;
+	delete wind_magnitude_resampled_;
+	delete trace_sampler_;
+	delete resampled_trace_sampler_;
+	delete pressure_;
 }
 void JetStream::DeletePreviousJet()
 {
@@ -71,14 +217,194 @@ const LineCollection& JetStream::GetJetCoreLines() {
 
 void JetStream::ComputeJetCoreLines() {
 	GenerateJetSeeds();
-	std::vector<Line3d> jet = FindJet(_seeds);
+	std::vector<Line3d> jet;
+	std::vector<size_t> line_ids;
+	if (jet_params_.temporal_tracking) {
+		jet = TrackJet(_seeds, line_ids);
+	}
+	else {
+		jet = FindJet(_seeds, std::vector<Line3d>());
+	}
 	jet_core_lines_ = LineCollection();
 	jet_core_lines_.SetData(jet);
+	jet_core_lines_.SetLineIds(line_ids);
 	jet_core_lines_ = FilterFalsePositives(jet_core_lines_);
 }
 
 /*
-		Iterates through the wind Magnitude scalar field to find local maximas.
+	Tracks the core lines of the previous time step, which have moved little at hourly resolution, instead of tracing all of them again.
+	Each vertex of the previous lines is moved onto the ridge of the current wind magnitude independently of the others, see ProjectOntoRidge.
+	A projected vertex is dropped where it leaves the domain or falls below the wind speed threshold, and the projected line is cut where it
+	runs into the projected lines before it, see CutAtMerges. A projected line which stays in one piece with min_projected_share of the vertices
+	keeps the id of its previous line. The other previous lines moved too far and are retraced from the seeds. Only the seeds farther than
+	kdtree_radius from the kept projected lines are traced, and their lines merge into the projected lines. A traced line gets the id of the
+	retraced previous line whose projection it follows most closely, or a new id of this time step, see line_ids_per_time_step.
+*/
+std::vector<Line3d> JetStream::TrackJet(Line3d& seeds, std::vector<size_t>& line_ids) {
+	std::vector<Line3d> projected;
+	// The ids of the previous lines which are retraced and the points of their projection, to find the retraced lines.
+	std::vector<size_t> retraced_ids;
+	std::vector<PointHashGrid> retraced_points;
+	if (previous_jet_ != nullptr) {
+		const LineCollection& previous = previous_jet_->GetJetCoreLines();
+		std::vector<Line3d> previous_lines = previous.GetLinesInVectorOfVector();
+
+		std::vector<size_t> line_begin({ 0 });
+		Points3d points;
+		for (const Line3d& line : previous_lines) {
+			points.insert(points.end(), line.begin(), line.end());
+			line_begin.push_back(points.size());
+		}
+		// Every projection_probe_stride-th vertex is projected first. The other vertices are only projected for the lines whose probes
+		// keep min_projected_share of the line in one piece, the others are retraced.
+		std::vector<uint8_t> valid(points.size(), 0);
+		std::vector<size_t> vertices;
+		for (size_t l = 0; l < previous_lines.size(); l++) {
+			for (size_t p = line_begin[l]; p < line_begin[l + 1]; p += projection_probe_stride) {
+				vertices.push_back(p);
+			}
+		}
+		ProjectVertices(vertices, points, valid);
+		std::vector<bool> retraced(previous_lines.size(), false);
+		vertices.clear();
+		for (size_t l = 0; l < previous_lines.size(); l++) {
+			size_t n_probes = 0;
+			size_t n_valid = 0;
+			size_t n_runs = 0;
+			for (size_t p = line_begin[l]; p < line_begin[l + 1]; p += projection_probe_stride) {
+				n_probes++;
+				if (valid[p]) {
+					n_runs += (n_valid == 0 || !valid[p - projection_probe_stride]) ? 1 : 0;
+					n_valid++;
+				}
+			}
+			retraced[l] = n_runs != 1 || n_valid < min_projected_share * n_probes;
+			if (retraced[l]) continue;
+			for (size_t p = line_begin[l]; p < line_begin[l + 1]; p++) {
+				if ((p - line_begin[l]) % projection_probe_stride != 0) {
+					vertices.push_back(p);
+				}
+			}
+		}
+		ProjectVertices(vertices, points, valid);
+
+		PointHashGrid projected_point_grid(std::sqrt(jet_params_.split_merge_threshold));
+		for (size_t l = 0; l < previous_lines.size(); l++) {
+			std::vector<Line3d> pieces;
+			if (!retraced[l]) {
+				Line3d piece;
+				for (size_t p = line_begin[l]; p <= line_begin[l + 1]; p++) {
+					if (p < line_begin[l + 1] && valid[p]) {
+						piece.push_back(points[p]);
+						continue;
+					}
+					for (const Line3d& cut : CutAtMerges(piece, projected_point_grid)) {
+						pieces.push_back(cut);
+					}
+					piece.clear();
+				}
+				size_t n_projected = 0;
+				for (const Line3d& cut : pieces) {
+					n_projected += cut.size();
+				}
+				retraced[l] = pieces.size() != 1 || n_projected < min_projected_share * previous_lines[l].size();
+			}
+			if (retraced[l]) {
+				Line3d valid_points;
+				for (size_t p = line_begin[l]; p < line_begin[l + 1]; p++) {
+					if (valid[p]) {
+						valid_points.push_back(points[p]);
+					}
+				}
+				if (!valid_points.empty() && l < previous.GetLineIds().size()) {
+					retraced_ids.push_back(previous.GetLineIds()[l]);
+					retraced_points.emplace_back(std::sqrt(jet_params_.kdtree_radius));
+					retraced_points.back().Insert(valid_points);
+				}
+				continue;
+			}
+			projected_point_grid.Insert(pieces[0]);
+			projected.push_back(pieces[0]);
+			line_ids.push_back(l < previous.GetLineIds().size() ? previous.GetLineIds()[l] : next_line_id_++);
+		}
+
+		// Only the seeds which the projected lines do not cover are traced.
+		PointOccupancyGrid seeds_grid(seeds, jet_params_.kdtree_radius);
+		std::vector<bool> covered(seeds.size(), false);
+		std::vector<size_t> covered_seeds;
+		for (const Line3d& line : projected) {
+			for (const Vec3d& point : line) {
+				covered_seeds.clear();
+				seeds_grid.FindWithinRadius(point, covered_seeds);
+				for (const size_t& seed : covered_seeds) {
+					covered[seed] = true;
+				}
+			}
+		}
+		Line3d uncovered;
+		for (size_t s = 0; s < seeds.size(); s++) {
+			if (!covered[s]) {
+				uncovered.push_back(seeds[s]);
+			}
+		}
+		seeds = uncovered;
+	}
+
+	std::vector<Line3d> traced = FindJet(seeds, projected);
+	// A retraced line gets the id of the previous line whose projection it covers most, every id at most once.
+	std::vector<size_t> traced_ids(traced.size(), SIZE_MAX);
+	for (size_t r = 0; r < retraced_ids.size(); r++) {
+		size_t best_line = SIZE_MAX;
+		size_t best_count = 0;
+		for (size_t l = 0; l < traced.size(); l++) {
+			if (traced_ids[l] != SIZE_MAX) continue;
+			size_t count = 0;
+			Vec3d closest;
+			for (const Vec3d& point : traced[l]) {
+				count += retraced_points[r].FindClosest(point, jet_params_.kdtree_radius, closest) ? 1 : 0;
+			}
+			if (count > best_count) {
+				best_count = count;
+				best_line = l;
+			}
+		}
+		if (best_line != SIZE_MAX) {
+			traced_ids[best_line] = retraced_ids[r];
+		}
+	}
+	for (size_t l = 0; l < traced.size(); l++) {
+		line_ids.push_back(traced_ids[l] != SIZE_MAX ? traced_ids[l] : next_line_id_++);
+	}
+	std::vector<Line3d> result = projected;
+	result.insert(result.end(), traced.begin(), traced.end());
+	return result;
+}
+
+/*
+	Moves the vertices points[vertices[i]] onto the ridge of the wind magnitude in parallel, see ProjectOntoRidge. A vertex is valid if it stays
+	in the domain and above the wind speed threshold.
+*/
+void JetStream::ProjectVertices(const std::vector<size_t>& vertices, Points3d& points, std::vector<uint8_t>& valid) {
+	size_t corrections = 0;
+	size_t steps = 0;
+#pragma omp parallel for reduction(+ : corrections, steps)
+	for (int v = 0; v < (int)vertices.size(); v++) {
+		const size_t p = vertices[v];
+		CorrectorStatistics statistics;
+		Vec3d pos = ProjectOntoRidge(ToDomainCoordinates(points[p]), statistics);
+		valid[p] = ConditionDomain(pos) && SampleWindMagnitude(pos) >= jet_params_.wind_speed_threshold;
+		points[p] = ToIndexCoordinates(pos);
+		corrections += statistics.corrections;
+		steps += statistics.steps;
+	}
+	CorrectorStatistics projection_statistics;
+	projection_statistics.corrections = corrections;
+	projection_statistics.steps = steps;
+	AddCorrectorStatistics(projection_statistics);
+}
+
+/*
+		Finds the local maxima of the smoothed wind magnitude on the pressure axis within the band [ps_min_val, ps_max_val] as seeds.
 		If the previous time step exists, the maximas of the core lines from the last time step will be taken as additional seeds.
 */
 void JetStream::GenerateJetSeeds() {
@@ -93,47 +419,79 @@ void JetStream::GenerateJetSeeds() {
 	}
 	double ps_min_idx = CoordinateConverter::IndexOfValueInArray(ps_axis_values_, (float)jet_params_.ps_min_val, true);
 	double ps_max_idx = CoordinateConverter::IndexOfValueInArray(ps_axis_values_, (float)jet_params_.ps_max_val, true);
-	size_t num_entries = (size_t)wind_magnitude_smooth_->GetField()->GetResolution()[0] * (size_t)wind_magnitude_smooth_->GetField()->GetResolution()[1] * (size_t)wind_magnitude_smooth_->GetField()->GetResolution()[2];
-
-
-#pragma omp parallel for schedule(dynamic,24)
-	for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-		Vec3i coords = wind_magnitude_smooth_->GetField()->GetGridCoord(linear_index);
-		if (coords[2] <= ps_min_idx && coords[2] >= ps_max_idx) {
-			Vec3d seed_candidate = Vec3d({ (double)coords[0], (double)coords[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) });
-			Vec3d up = Vec3d({ (double)coords[0], (double)coords[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) + 10.0 });
-			Vec3d down = Vec3d({ (double)coords[0], (double)coords[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) - 10.0 });
-			Vec3d left = Vec3d({ (double)coords[0] - 1, (double)coords[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) });
-			Vec3d right = Vec3d({ (double)coords[0] + 1, (double)coords[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) });
-			Vec3d front = Vec3d({ (double)coords[0], (double)coords[1] + 1, CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) });
-			Vec3d back = Vec3d({ (double)coords[0], (double)coords[1] - 1, CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)coords[2], true) });
-
-			float wind_mag = wind_magnitude_smooth_->Sample(seed_candidate);
-
-			float w_up = wind_magnitude_smooth_->Sample(up);
-			float w_down = wind_magnitude_smooth_->Sample(down);
-			float w_left = wind_magnitude_smooth_->Sample(left);
-			float w_right = wind_magnitude_smooth_->Sample(right);
-			float w_front = wind_magnitude_smooth_->Sample(front);
-			float w_back = wind_magnitude_smooth_->Sample(back);
-
-			if (wind_mag >= jet_params_.wind_speed_threshold && wind_mag > std::max({ w_up, w_down,w_left, w_right, w_front, w_back })) {
-				if (previous_jet_ != nullptr) {
-					Line3d closeby_prev_jet_seeds = FindPointsWithinRadius(prev_jet_tree, prev_jet_cloud, jet_params_.kdtree_radius, coords);
-					if (closeby_prev_jet_seeds.size() == 0) {
-						mtx_.lock();
-						_seeds.push_back(coords);
-						mtx_.unlock();
-					}
-				}
-				else {
-					mtx_.lock();
-					_seeds.push_back(coords);
-					mtx_.unlock();
+	// The seeds are searched on the pressure axis, independent of the loaded model levels.
+	Vec3i seed_grid_resolution = Vec3i({ wind_magnitude_smooth_->GetField()->GetResolution()[0], wind_magnitude_smooth_->GetField()->GetResolution()[1], (int)ps_axis_values_.size() });
+	// Only the levels ps_max_idx <= k <= ps_min_idx are searched.
+	const int k_begin = std::max(0, (int)std::ceil(ps_max_idx));
+	const int k_end = std::min(seed_grid_resolution[2], (int)std::floor(ps_min_idx) + 1);
+	if (k_begin >= k_end) {
+		delete prev_jet_tree;
+		return;
+	}
+
+	/*
+		The smoothed wind magnitude is resampled once onto the levels of the band and the levels 10 hPa above and below it, which are the
+		vertical neighbors of the 10 hPa pressure axis. The resampled values at the grid points are the values which Sample returns there,
+		and Sample clamps the horizontal neighbors at the border to the border column. Slab s of the resampled band is level k_end - s.
+	*/
+	std::vector<float> slab_pressures;
+	slab_pressures.push_back(CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)(k_end - 1), true) - 10.f);
+	for (int k = k_end - 1; k >= k_begin; k--) {
+		slab_pressures.push_back(CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)k, true));
+	}
+	slab_pressures.push_back(CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)k_begin, true) + 10.f);
+	RegularGrid<float, 3>* band = wind_magnitude_smooth_->ResampleToPressureAxis(slab_pressures);
+	const GridStencil<float> stencil(*band);
+	const Vec3i& band_res = band->GetResolution();
+
+	// The local maxima are collected per thread as linear indices on the seed grid and sorted, which gives the same seeds in the same order for any number of threads.
+#ifdef _OPENMP
+	std::vector<std::vector<int64_t>> thread_maxima(omp_get_max_threads());
+#else
+	std::vector<std::vector<int64_t>> thread_maxima(1);
+#endif
+	// Only the rows of the traced latitudes are searched.
+	const Vec2d latitude_range = GetLatitudeRange();
+	const int j_begin = (int)std::ceil(latitude_range[0]);
+	const int j_end = (int)std::floor(latitude_range[1]) + 1;
+	ForEachRow(band_res, Vec3i({ 0, j_begin, 1 }), Vec3i({ band_res[0], j_end, band_res[2] - 1 }), [&](const int& j, const int& s, const int64_t&) {
+#ifdef _OPENMP
+		std::vector<int64_t>& maxima = thread_maxima[omp_get_thread_num()];
+#else
+		std::vector<int64_t>& maxima = thread_maxima[0];
+#endif
+		const int k = k_end - s;
+		const float* row = stencil.Row(j, s);
+		const float* row_up = stencil.Row(j, s + 1);
+		const float* row_down = stencil.Row(j, s - 1);
+		const float* row_front = stencil.Row(std::min(j + 1, band_res[1] - 1), s);
+		const float* row_back = stencil.Row(std::max(j - 1, 0), s);
+		for (int i = 0; i < band_res[0]; i++) {
+			float wind_mag = row[i];
+			if (wind_mag < jet_params_.wind_speed_threshold) {
+				continue;
+			}
+			float w_left = row[std::max(i - 1, 0)];
+			float w_right = row[std::min(i + 1, band_res[0] - 1)];
+			if (wind_mag > std::max({ row_up[i], row_down[i], w_left, w_right, row_front[i], row_back[i] })) {
+				Vec3i coords = Vec3i({ i, j, k });
+				if (previous_jet_ != nullptr && FindPointsWithinRadius(prev_jet_tree, prev_jet_cloud, jet_params_.kdtree_radius, coords).size() != 0) {
+					continue;
 				}
+				maxima.push_back(((int64_t)k * seed_grid_resolution[1] + j) * seed_grid_resolution[0] + i);
 			}
 		}
+	});
+	delete band;
 
+	std::vector<int64_t> maxima;
+	for (const std::vector<int64_t>& thread_buffer : thread_maxima) {
+		maxima.insert(maxima.end(), thread_buffer.begin(), thread_buffer.end());
+	}
+	std::sort(maxima.begin(), maxima.end());
+	for (const int64_t& linear_index : maxima) {
+		const int64_t slice_size = (int64_t)seed_grid_resolution[0] * seed_grid_resolution[1];
+		_seeds.push_back(Vec3d({ (double)(linear_index % seed_grid_resolution[0]), (double)((linear_index % slice_size) / seed_grid_resolution[0]), (double)(linear_index / slice_size) }));
 	}
 	delete prev_jet_tree;
 }
@@ -149,9 +507,9 @@ Points3d JetStream::GetPreviousTimeStepSeeds()
 		for (auto line : prev_jet) {
 			if (line.size() < 3) { continue; }
 			for (int i = 1; i < line.size() - 1; i++) {
-				double left = wind_magnitude_->Sample(ToDomainCoordinates(line[i - 1ll]));
-				double centre = wind_magnitude_->Sample(ToDomainCoordinates(line[i]));
-				double right = wind_magnitude_->Sample(ToDomainCoordinates(line[i + 1ll]));
+				double left = SampleWindMagnitude(ToDomainCoordinates(line[i - 1ll]));
+				double centre = SampleWindMagnitude(ToDomainCoordinates(line[i]));
+				double right = SampleWindMagnitude(ToDomainCoordinates(line[i + 1ll]));
 				if (centre > left && centre > right) {
 					res.push_back(line[i]);
 				}
@@ -173,44 +531,208 @@ Points3d JetStream::GetPreviousTimeStepSeeds()
 	To compute anything, especially in combination with vector fields, we use pos_ps=(x, y, pressure[hPa]). x and y are always the lonitude and latitude index.
 	This way, one avoids having to flip the gradient because the Sample function of the era field never flips the z axis. Only the resample function flips it.
 	Basically the flipping only happens at the very end after all computation is already finished.
+
+	The seeds are traced in order of decreasing wind magnitude. A traced line removes the seeds it passes and merges into the lines committed before it.
+	To use all cores, a batch of the strongest remaining seeds is traced speculatively in parallel against the lines committed before the batch.
+	The strongest seeds mostly lie on the same jet, so a trace stops at once, or is not started, if the trace of an earlier seed of the batch passed
+	its seed or if it passes an earlier seed itself, see SeedBatch. The threads then move on to the seeds of other jets.
+	The traces are then committed in the serial order. A trace is discarded if its seed was removed by an earlier trace. A trace which was stopped,
+	or which checked for a merge close to a line committed after it started, is deferred: Its seed is traced first in the next batch against all
+	lines committed so far, and the complete traces after it are kept for their seeds. The result is the same as tracing one seed after another.
+	The traced lines also merge into the already committed lines, which are not returned.
 */
-std::vector<Line3d> JetStream::FindJet(Line3d& seeds) {
-	double dt = jet_params_.integration_stepsize;
+std::vector<Line3d> JetStream::FindJet(Line3d& seeds, const std::vector<Line3d>& committed) {
 	std::vector<Line3d> result;
+	// The points of the committed jet core lines. The cell size is the merge distance sqrt(split_merge_threshold).
+	PointHashGrid jet_point_grid(std::sqrt(jet_params_.split_merge_threshold));
+	for (const Line3d& line : committed) {
+		jet_point_grid.Insert(line);
+	}
 
-	std::set<Vec3d, decltype(wind_magnitude_comparator_)> seeds_set(wind_magnitude_comparator_);
-	jet_kd_tree = new KdTree3d(3, jet_point_cloud, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */));
-
-	for (int i = 0; i < seeds.size(); i++) {
-		seeds_set.insert(seeds[i]);
+	// The wind magnitude of each seed is sampled once, the seed queue orders the seed indices by it.
+	std::vector<float> seed_wind_magnitudes(seeds.size());
+#pragma omp parallel for
+	for (int i = 0; i < (int)seeds.size(); i++) {
+		seed_wind_magnitudes[i] = wind_magnitude_->Sample(ToDomainCoordinates(seeds[i]));
 	}
+	SeedQueue seed_queue(seed_wind_magnitudes);
+
+	// Tracing removes the seeds within kdtree_radius of the traced positions.
+	PointOccupancyGrid seeds_grid(seeds, jet_params_.kdtree_radius);
 
-	PointCloud3d seeds_point_cloud;
-	seeds_point_cloud.pts = seeds;
-	KdTree3d* seeds_kd_tree = new KdTree3d(3, seeds_point_cloud, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */));
-	seeds_kd_tree->buildIndex();
+#ifdef _OPENMP
+	const size_t n_threads = (size_t)omp_get_max_threads();
+#else
+	const size_t n_threads = 1;
+#endif
+	// Most seeds of a batch are skipped because earlier traces pass them, so the batch holds more seeds than there are threads.
+	const size_t batch_size = n_threads > 1 ? n_threads * speculative_seeds_per_thread : 1;
+	std::vector<size_t> batch;
+	SeedBatch seed_batch(seeds.size());
+	std::vector<SeedTrace> traces;
+	// The complete traces of the seeds after a deferred trace, which are committed later if they did not come close to the lines committed since.
+	std::unordered_map<size_t, SeedTrace> pending_traces;
+	std::vector<int> traced_ranks;
+	while (!seed_queue.IsEmpty()) {
+		seed_queue.GetFront(batch_size, batch);
+		seed_batch.Assign(batch);
+		traces.assign(batch.size(), SeedTrace());
+		traced_ranks.clear();
+		for (int b = 0; b < (int)batch.size(); b++) {
+			auto pending = pending_traces.find(batch[b]);
+			if (pending == pending_traces.end()) {
+				traced_ranks.push_back(b);
+				continue;
+			}
+			traces[b] = std::move(pending->second);
+			pending_traces.erase(pending);
+			for (const size_t& passed_seed : traces[b].passed_seeds) {
+				seed_batch.Pass(b, passed_seed);
+			}
+		}
+		// The seeds are started in order, such that the earlier traces flag the later seeds before these are started.
+#pragma omp parallel for schedule(dynamic, 1)
+		for (int t = 0; t < (int)traced_ranks.size(); t++) {
+			const int b = traced_ranks[t];
+			if (seed_batch.IsPassed(b)) {
+				traces[b].complete = false;
+				continue;
+			}
+			traces[b] = TraceSeed(seeds[batch[b]], b, seed_batch, seeds_grid, jet_point_grid);
+		}
+		// The new traces saw the points committed so far. The statistics count the work of all traces, also of the discarded ones.
+		for (const int& b : traced_ranks) {
+			traces[b].first_jet_point = jet_point_grid.GetSize();
+			AddCorrectorStatistics(traces[b].corrector_statistics);
+		}
 
-	while (seeds_set.size() != 0) {
-		Vec3d seed = *(seeds_set.begin());
-		seeds_set.erase(seeds_set.begin());
-		Line3d jet({ seed });
-		// Forward tracing
-		Trace(jet, seeds_set, seeds_kd_tree, seeds_point_cloud, false);
-		RemoveWrongStartUps(jet);
-		// Backward tracing
-		Trace(jet, seeds_set, seeds_kd_tree, seeds_point_cloud, true);
-		CutWeakEndings(jet);
-		if (GetLineDistance(jet) >= jet_params_.min_jet_distance) {
-			result.push_back(jet);
-			UpdateKdTree(jet);
+		for (size_t b = 0; b < batch.size(); b++) {
+			// Skips the seeds of the batch which were removed by earlier traces.
+			if (!seed_queue.Contains(batch[b])) {
+				continue;
+			}
+			if (!traces[b].complete || MergesWith(traces[b], jet_point_grid)) {
+				// The seed is at the front of the next batch, whose first trace is never stopped and sees all committed lines.
+				for (size_t later = b + 1; later < batch.size(); later++) {
+					if (traces[later].complete && seed_queue.Contains(batch[later])) {
+						pending_traces[batch[later]] = std::move(traces[later]);
+					}
+				}
+				break;
+			}
+			seed_queue.Remove(batch[b]);
+			const SeedTrace& trace = traces[b];
+			for (const size_t& passed_seed : trace.passed_seeds) {
+				seed_queue.Remove(passed_seed);
+			}
+			if (GetLineDistance(trace.jet) >= jet_params_.min_jet_distance) {
+				result.push_back(trace.jet);
+				jet_point_grid.Insert(trace.jet);
+			}
 		}
+	}
+	return result;
+}
 
+/*
+	Cuts the line where it comes within the merge distance of the points in the grid and joins the pieces to the closest points at their cut ends.
+	Returns the pieces which are at least min_jet_distance long.
+*/
+std::vector<Line3d> JetStream::CutAtMerges(const Line3d& line, const PointHashGrid& point_grid) const {
+	std::vector<Line3d> result;
+	Line3d piece;
+	Vec3d closest;
+	Vec3d last_closest;
+	bool previous_merged = false;
+	for (const Vec3d& point : line) {
+		if (!point_grid.IsEmpty() && point_grid.FindClosest(point, jet_params_.split_merge_threshold, closest)) {
+			if (!piece.empty()) {
+				piece.push_back(closest);
+				if (GetLineDistance(piece) >= jet_params_.min_jet_distance) {
+					result.push_back(piece);
+				}
+				piece.clear();
+			}
+			previous_merged = true;
+			last_closest = closest;
+			continue;
+		}
+		if (piece.empty() && previous_merged) {
+			piece.push_back(last_closest);
+		}
+		piece.push_back(point);
+		previous_merged = false;
+	}
+	if (GetLineDistance(piece) >= jet_params_.min_jet_distance) {
+		result.push_back(piece);
 	}
-	delete seeds_kd_tree;
 	return result;
 }
 
-void JetStream::Trace(Line3d& line, std::set<Vec3d, decltype(wind_magnitude_comparator_)>& seeds_set, KdTree3d* seeds_kd_tree, PointCloud3d& seeds_point_cloud, bool inverse) {
+/*
+	Returns the range [begin, end] of latitude indices which are traced. The equator is at the center index. The northern hemisphere is above it
+	if the latitude axis is ascending and below it otherwise.
+*/
+Vec2d JetStream::GetLatitudeRange() const {
+	const double n_lat = wind_direction_normalized_->GetField()->GetResolution()[1];
+	const double equator = (n_lat - 1) / 2;
+	const Vec2d upper_half({ equator, n_lat - 1 });
+	const Vec2d lower_half({ 0., equator });
+	switch (jet_params_.hemisphere) {
+	case HEMISPHERE::NORTH:
+		return latitude_ascending_ ? upper_half : lower_half;
+	case HEMISPHERE::SOUTH:
+		return latitude_ascending_ ? lower_half : upper_half;
+	default:
+		return Vec2d({ 0., n_lat - 1 });
+	}
+}
+
+/*
+	Traces the seed forward and backward against the committed core lines. Only reads the state of the jet stream, so seeds can be traced concurrently.
+	rank is the rank of the seed in the batch. The trace flags the later seeds of the batch which it passes and stops once its own seed is flagged.
+*/
+JetStream::SeedTrace JetStream::TraceSeed(const Vec3d& seed, const int& rank, SeedBatch& batch, const PointOccupancyGrid& seeds_grid, const PointHashGrid& jet_point_grid) const {
+	SeedTrace trace;
+	trace.jet = Line3d({ seed });
+	// Forward tracing
+	Trace(trace, rank, batch, seeds_grid, jet_point_grid, false);
+	if (!trace.complete) {
+		return trace;
+	}
+	RemoveWrongStartUps(trace.jet, trace.corrector_statistics);
+	// Backward tracing
+	Trace(trace, rank, batch, seeds_grid, jet_point_grid, true);
+	if (!trace.complete) {
+		return trace;
+	}
+	CutWeakEndings(trace.jet);
+	if (jet_params_.max_vertex_spacing > 0) {
+		SubdivideLongSegments(trace.jet);
+	}
+	return trace;
+}
+
+/*
+	Returns true if one of the merge checks of the trace lies within the merge threshold of a point which was added to the grid after the trace
+	started, i.e. if the trace could have merged into a line which it did not see.
+*/
+bool JetStream::MergesWith(const SeedTrace& trace, const PointHashGrid& point_grid) const {
+	for (const Vec3d& position : trace.merge_checks) {
+		if (point_grid.ContainsWithin(position, jet_params_.split_merge_threshold, trace.first_jet_point)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void JetStream::AddCorrectorStatistics(const CorrectorStatistics& statistics) {
+	corrector_statistics_.corrections += statistics.corrections;
+	corrector_statistics_.steps += statistics.steps;
+}
+
+void JetStream::Trace(SeedTrace& trace, const int& rank, SeedBatch& batch, const PointOccupancyGrid& seeds_grid, const PointHashGrid& jet_point_grid, bool inverse) const {
+	Line3d& line = trace.jet;
 	Line3d traced_line;
 	if (line.size() == 0) { return; }
 	Vec3d pos;
@@ -221,21 +743,32 @@ void JetStream::Trace(Line3d& line, std::set<Vec3d, decltype(wind_magnitude_comp
 		pos = ToDomainCoordinates(line[line.size() - 1]);
 	}
 	int speed_criteria_not_met = 0;
+	double step_size = jet_params_.integration_stepsize;
 	do {
-		if (!ConditionDomain(pos) || !ConditionWindMagnitude(pos, speed_criteria_not_met)) {
+		if (batch.IsPassed(rank)) {
+			trace.complete = false;
+			break;
+		}
+		if (!ConditionDomain(pos)) {
+			break;
+		}
+		// The wind magnitude for the stopping criterion and the wind direction for the first predictor stage are sampled together.
+		auto [direction, wind_mag] = SampleTraceFields<DIRECTION, MAGNITUDE>(pos);
+		if (!ConditionWindMagnitude(wind_mag, speed_criteria_not_met)) {
 			break;
 		}
 		Vec3d corr_pos;
 		if (inverse) {
-			corr_pos = InversePredictorCorrectorStep(pos);
+			corr_pos = InversePredictorCorrectorStep(pos, direction, step_size, trace.corrector_statistics);
 		}
 		else {
-			corr_pos = PredictorCorrectorStep(pos);
+			corr_pos = PredictorCorrectorStep(pos, direction, step_size, trace.corrector_statistics);
 		}
 		if (ConditionDomain(corr_pos)) {
 			traced_line.push_back(ToIndexCoordinates(corr_pos));
-			if (!jet_point_cloud.is_empty()) {
-				Vec3d closest = FindClosestJetPoint(jet_params_.split_merge_threshold, ToIndexCoordinates(corr_pos));
+			trace.merge_checks.push_back(traced_line.back());
+			if (!jet_point_grid.IsEmpty()) {
+				Vec3d closest = FindClosestJetPoint(jet_point_grid, jet_params_.split_merge_threshold, ToIndexCoordinates(corr_pos));
 				if (closest != Vec3d({ -1, -1, -1 })) {
 					traced_line.push_back(closest);
 					break;
@@ -244,9 +777,10 @@ void JetStream::Trace(Line3d& line, std::set<Vec3d, decltype(wind_magnitude_comp
 		}
 		pos = corr_pos;
 
-		Line3d nearby_seeds = FindPointsWithinRadius(seeds_kd_tree, seeds_point_cloud, jet_params_.kdtree_radius, ToIndexCoordinates(corr_pos));
-		for (int j = 0; j < nearby_seeds.size(); j++) {
-			seeds_set.erase(nearby_seeds[j]);
+		const size_t n_passed = trace.passed_seeds.size();
+		seeds_grid.FindWithinRadius(ToIndexCoordinates(corr_pos), trace.passed_seeds);
+		for (size_t p = n_passed; p < trace.passed_seeds.size(); p++) {
+			batch.Pass(rank, trace.passed_seeds[p]);
 		}
 	} while (traced_line.size() + line.size() < jet_params_.stopping_criteria_jet);
 
@@ -259,7 +793,7 @@ void JetStream::Trace(Line3d& line, std::set<Vec3d, decltype(wind_magnitude_comp
 	}
 }
 
-void JetStream::RemoveWrongStartUps(Line3d& jet_line) const {
+void JetStream::RemoveWrongStartUps(Line3d& jet_line, CorrectorStatistics& statistics) const {
 	double threshold = 0.5;
 	while (jet_line.size() >= 2) {
 		Vec3d start_point = Vec3d({ jet_line[0][0], jet_line[0][1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)jet_line[0][2], true) });
@@ -267,7 +801,8 @@ void JetStream::RemoveWrongStartUps(Line3d& jet_line) const {
 		Vec3d jet_direction = next_point - start_point;
 		jet_direction.normalize();
 
-		Vec3d corr_pos = InversePredictorCorrectorStep(start_point);
+		double step_size = jet_params_.integration_stepsize;
+		Vec3d corr_pos = InversePredictorCorrectorStep(start_point, SampleWindDirection(start_point), step_size, statistics);
 		Vec3d inverse_jet_direction = corr_pos - start_point;
 		inverse_jet_direction.normalize();
 		double projection = jet_direction.dot(inverse_jet_direction);
@@ -283,12 +818,12 @@ void JetStream::RemoveWrongStartUps(Line3d& jet_line) const {
 /*
 	Cuts the endings of the jet if they are below threshold.
 */
-void JetStream::CutWeakEndings(Line3d& jet) {
+void JetStream::CutWeakEndings(Line3d& jet) const {
 	if (jet.size() >= 2) {
 		int left = 0;
 		int right = (int)jet.size() - 1;
-		float wm_l = wind_magnitude_->Sample(ToDomainCoordinates(jet[left]));
-		float wm_r = wind_magnitude_->Sample(ToDomainCoordinates(jet[right]));
+		float wm_l = SampleWindMagnitude(ToDomainCoordinates(jet[left]));
+		float wm_r = SampleWindMagnitude(ToDomainCoordinates(jet[right]));
 		while (wm_l < jet_params_.wind_speed_threshold || wm_r < jet_params_.wind_speed_threshold) {
 			if ((wm_l < jet_params_.wind_speed_threshold && wm_r < jet_params_.wind_speed_threshold)) {
 				left++;
@@ -304,8 +839,8 @@ void JetStream::CutWeakEndings(Line3d& jet) {
 				break;
 			}
 			if (left < right) {
-				wm_l = wind_magnitude_->Sample(ToDomainCoordinates(jet[left]));
-				wm_r = wind_magnitude_->Sample(ToDomainCoordinates(jet[right]));
+				wm_l = SampleWindMagnitude(ToDomainCoordinates(jet[left]));
+				wm_r = SampleWindMagnitude(ToDomainCoordinates(jet[right]));
 			}
 			else {
 				jet.clear();
@@ -330,39 +865,51 @@ void JetStream::CutWeakEndings(Line3d& jet) {
 	}
 }
 
-Vec3d JetStream::PredictorCorrectorStep(const Vec3d& pos) const {
+/*
+	direction is the wind direction at pos. step_size is the predictor step size. In the adaptive mode it is updated to the proposed size of the next step.
+	The corrector uses the size of the last predictor step, i.e. integration_stepsize or, in the adaptive mode, the size of the accepted step.
+*/
+Vec3d JetStream::PredictorCorrectorStep(const Vec3d& pos, const Vec3d& direction, double& step_size, CorrectorStatistics& statistics) const {
 	Vec3d pred_pos = pos;
+	double corrector_stepsize = jet_params_.integration_stepsize;
 	for (int i = 0; i < jet_params_.n_predictor_steps; i++) {
-		pred_pos = PredictorStepRK4(pred_pos, jet_params_.integration_stepsize);
+		Vec3d k1 = i == 0 ? direction : SampleWindDirection(pred_pos);
+		if (jet_params_.adaptive_stepsize) {
+			pred_pos = PredictorStepDormandPrince(pred_pos, k1, 1.0, step_size, corrector_stepsize);
+		}
+		else {
+			pred_pos = PredictorStepRK4(pred_pos, k1, jet_params_.integration_stepsize);
+		}
 	}
 	Vec3d corr_pos = pred_pos;
-	for (int i = 0; i < jet_params_.n_corrector_steps; i++) {
-		corr_pos = CorrectorStepRK4(corr_pos, jet_params_.integration_stepsize);
-	}
-	return corr_pos;
+	// The corrector moves as far as the predictor, otherwise large adaptive steps are not pulled back onto the ridge.
+	return Correct(corr_pos, corrector_stepsize, statistics);
 }
 
-Vec3d JetStream::InversePredictorCorrectorStep(const Vec3d& pos) const {
+Vec3d JetStream::InversePredictorCorrectorStep(const Vec3d& pos, const Vec3d& direction, double& step_size, CorrectorStatistics& statistics) const {
 	Vec3d pre_pos = pos;
+	double corrector_stepsize = jet_params_.integration_stepsize;
 	for (int i = 0; i < jet_params_.n_predictor_steps; i++) {
-		pre_pos = PredictorStepRK4Inverse(pre_pos, jet_params_.integration_stepsize);
+		Vec3d k1 = i == 0 ? direction : SampleWindDirection(pre_pos);
+		if (jet_params_.adaptive_stepsize) {
+			pre_pos = PredictorStepDormandPrince(pre_pos, k1, -1.0, step_size, corrector_stepsize);
+		}
+		else {
+			pre_pos = PredictorStepRK4Inverse(pre_pos, k1, jet_params_.integration_stepsize);
+		}
 	}
 	Vec3d corr_pos = pre_pos;
-	for (int i = 0; i < jet_params_.n_corrector_steps; i++) {
-		corr_pos = CorrectorStepRK4(corr_pos, jet_params_.integration_stepsize);
-	}
-	return corr_pos;
+	// The corrector moves as far as the predictor, otherwise large adaptive steps are not pulled back onto the ridge.
+	return Correct(corr_pos, corrector_stepsize, statistics);
 }
 
 /*
-	Perfoms a Runke-Kutta 4 step in the wind direction.
+	Perfoms a Runke-Kutta 4 step in the wind direction. k1 is the wind direction at pos.
 */
-Vec3d JetStream::PredictorStepRK4(const Vec3d& pos, double dt) const {
-
-	Vec3d k1 = wind_direction_normalized_->Sample(pos);
-	Vec3d k2 = wind_direction_normalized_->Sample(pos + k1 * (dt / 2));
-	Vec3d k3 = wind_direction_normalized_->Sample(pos + k2 * (dt / 2));
-	Vec3d k4 = wind_direction_normalized_->Sample(pos + k3 * dt);
+Vec3d JetStream::PredictorStepRK4(const Vec3d& pos, const Vec3d& k1, double dt) const {
+	Vec3d k2 = SampleWindDirection(pos + k1 * (dt / 2));
+	Vec3d k3 = SampleWindDirection(pos + k2 * (dt / 2));
+	Vec3d k4 = SampleWindDirection(pos + k3 * dt);
 	Vec3d v = (k1 / 6 + k2 / 3 + k3 / 3 + k4 / 6);
 	v.normalize();
 	return pos + v * dt;
@@ -370,15 +917,154 @@ Vec3d JetStream::PredictorStepRK4(const Vec3d& pos, double dt) const {
 /*
   Performs a step in the opposite wind direction at pos.
 */
-Vec3d  JetStream::PredictorStepRK4Inverse(const Vec3d& pos, double dt) const {
-	Vec3d k1 = wind_direction_normalized_->Sample(pos);
-	Vec3d k2 = wind_direction_normalized_->Sample(pos + k1 * (dt / 2));
-	Vec3d k3 = wind_direction_normalized_->Sample(pos + k2 * (dt / 2));
-	Vec3d k4 = wind_direction_normalized_->Sample(pos + k3 * dt);
+Vec3d  JetStream::PredictorStepRK4Inverse(const Vec3d& pos, const Vec3d& k1, double dt) const {
+	Vec3d k2 = SampleWindDirection(pos + k1 * (dt / 2));
+	Vec3d k3 = SampleWindDirection(pos + k2 * (dt / 2));
+	Vec3d k4 = SampleWindDirection(pos + k3 * dt);
 	Vec3d v = (k1 / 6 + k2 / 3 + k3 / 3 + k4 / 6);
 	v.normalize();
 	return pos + -v * dt;
 }
+/*
+	Performs a Dormand-Prince 5(4) step in the wind direction (sign 1) or in the opposite direction (sign -1). k1 is the wind direction at pos.
+	dt is the step size to try. The step is repeated with a smaller size until the local error estimate is at most adaptive_tolerance or the size
+	reaches min_stepsize. taken_dt is set to the size of the accepted step and dt to the proposed size of the next step within [min_stepsize, max_stepsize].
+*/
+Vec3d JetStream::PredictorStepDormandPrince(const Vec3d& pos, const Vec3d& k1, const double& sign, double& dt, double& taken_dt) const {
+	const Vec3d f1 = k1 * sign;
+	while (true) {
+		const double h = dt;
+		Vec3d f2 = SampleWindDirection(pos + f1 * (h / 5)) * sign;
+		Vec3d f3 = SampleWindDirection(pos + (f1 * (3. / 40) + f2 * (9. / 40)) * h) * sign;
+		Vec3d f4 = SampleWindDirection(pos + (f1 * (44. / 45) - f2 * (56. / 15) + f3 * (32. / 9)) * h) * sign;
+		Vec3d f5 = SampleWindDirection(pos + (f1 * (19372. / 6561) - f2 * (25360. / 2187) + f3 * (64448. / 6561) - f4 * (212. / 729)) * h) * sign;
+		Vec3d f6 = SampleWindDirection(pos + (f1 * (9017. / 3168) - f2 * (355. / 33) + f3 * (46732. / 5247) + f4 * (49. / 176) - f5 * (5103. / 18656)) * h) * sign;
+		Vec3d next = pos + (f1 * (35. / 384) + f3 * (500. / 1113) + f4 * (125. / 192) - f5 * (2187. / 6784) + f6 * (11. / 84)) * h;
+		Vec3d f7 = SampleWindDirection(next) * sign;
+		// Difference of the 5th and the embedded 4th order solution.
+		Vec3d error = (f1 * (71. / 57600) - f3 * (71. / 16695) + f4 * (71. / 1920) - f5 * (17253. / 339200) + f6 * (22. / 525) - f7 * (1. / 40)) * h;
+		double error_norm = error.length();
+
+		double scale = error_norm > 0 ? 0.9 * std::pow(jet_params_.adaptive_tolerance / error_norm, 0.2) : 5.0;
+		dt = std::min(jet_params_.max_stepsize, std::max(jet_params_.min_stepsize, h * std::min(5.0, std::max(0.2, scale))));
+		if (error_norm <= jet_params_.adaptive_tolerance || h <= jet_params_.min_stepsize) {
+			taken_dt = h;
+			return next;
+		}
+	}
+}
+
+/*
+	Inserts linearly interpolated vertices, such that no segment of the line is longer than max_vertex_spacing.
+*/
+void JetStream::SubdivideLongSegments(Line3d& line) const {
+	if (line.size() < 2) return;
+	Line3d subdivided({ line[0] });
+	for (size_t i = 1; i < line.size(); i++) {
+		Vec3d segment = line[i] - line[i - 1];
+		int n_parts = (int)std::ceil(segment.length() / jet_params_.max_vertex_spacing);
+		for (int part = 1; part < n_parts; part++) {
+			subdivided.push_back(line[i - 1] + segment * ((double)part / n_parts));
+		}
+		subdivided.push_back(line[i]);
+	}
+	line = subdivided;
+}
+
+/*
+	Moves the predicted position pos onto the ridge of the wind magnitude with the corrector steps of jet_params_.corrector and counts the steps.
+	The Newton corrector takes an RK4 step where its step is not defined.
+*/
+Vec3d JetStream::Correct(const Vec3d& pos, const double& dt, CorrectorStatistics& statistics) const {
+	statistics.corrections++;
+	Vec3d corr_pos = pos;
+	for (int i = 0; i < jet_params_.n_corrector_steps; i++) {
+		Vec3d next;
+		if (jet_params_.corrector != CORRECTOR::NEWTON || !CorrectorStepNewton(corr_pos, dt, next)) {
+			next = CorrectorStepRK4(corr_pos, dt);
+		}
+		statistics.steps++;
+		bool converged = jet_params_.corrector != CORRECTOR::RK4 && (next - corr_pos).length() < jet_params_.corrector_tolerance;
+		corr_pos = next;
+		if (converged) {
+			break;
+		}
+	}
+	return corr_pos;
+}
+
+/*
+	Moves pos onto the ridge of the wind magnitude with at most tracking_corrector_steps corrector steps. Newton steps are taken independent of
+	jet_params_.corrector, since the points start close to the ridge, with RK4 steps where they are not defined. The steps are at most
+	tracking_stepsize long, which is halved whenever a step turns back, i.e. after it crossed the ridge, until it is shorter than integration_stepsize.
+	The projection also stops once a step is shorter than corrector_tolerance. A point moves up to tracking_corrector_steps * tracking_stepsize.
+*/
+Vec3d JetStream::ProjectOntoRidge(const Vec3d& pos, CorrectorStatistics& statistics) const {
+	statistics.corrections++;
+	Vec3d proj_pos = pos;
+	Vec3d last_step = Vec3d({ 0, 0, 0 });
+	double dt = jet_params_.tracking_stepsize;
+	for (int i = 0; i < jet_params_.tracking_corrector_steps && dt >= jet_params_.integration_stepsize; i++) {
+		Vec3d next;
+		if (!CorrectorStepNewton(proj_pos, dt, next)) {
+			next = CorrectorStepRK4(proj_pos, dt);
+		}
+		statistics.steps++;
+		Vec3d step = next - proj_pos;
+		if (step.dot(last_step) < 0) {
+			dt /= 2;
+		}
+		proj_pos = next;
+		last_step = step;
+		if (step.length() < jet_params_.corrector_tolerance) {
+			break;
+		}
+	}
+	return proj_pos;
+}
+
+/*
+	Performs a Newton step towards the point in the plane normal to the wind direction at pos, where the gradient of the wind magnitude projected
+	on the plane vanishes. The Jacobian of the projected gradient is approximated by forward differences of length dt, so a step samples the fields
+	three times instead of eight times like the RK4 step. The step is at most dt long, like the RK4 step.
+	Returns false if the projected Jacobian is not negative definite, i.e. if pos is not close to a ridge, or if the wind is vertical.
+*/
+bool JetStream::CorrectorStepNewton(const Vec3d& pos, const double& dt, Vec3d& next) const {
+	auto [sampled_gradient, sampled_direction] = SampleTraceFields<GRADIENT, DIRECTION>(pos);
+	Vec3d gradient = sampled_gradient;
+	Vec3d direction = sampled_direction;
+	// Orthonormal basis of the plane, e1 is horizontal.
+	Vec3d e1 = cross(direction, Vec3d({ 0, 0, 1 }));
+	double length;
+	e1.normalize(&length);
+	if (length < 1e-6) {
+		return false;
+	}
+	Vec3d e2 = cross(direction, e1);
+	e2.normalize();
+
+	Vec3d g1 = SampleWindMagnitudeGradient(pos + e1 * dt);
+	Vec3d g2 = SampleWindMagnitudeGradient(pos + e2 * dt);
+	double f1 = gradient.dot(e1);
+	double f2 = gradient.dot(e2);
+	double j11 = (g1.dot(e1) - f1) / dt;
+	double j12 = (g2.dot(e1) - f1) / dt;
+	double j21 = (g1.dot(e2) - f2) / dt;
+	double j22 = (g2.dot(e2) - f2) / dt;
+	double j_sym = (j12 + j21) / 2;
+	double det = j11 * j22 - j12 * j21;
+	if (j11 >= 0 || j11 * j22 - j_sym * j_sym <= 0 || det == 0) {
+		return false;
+	}
+	Vec3d step = e1 * ((f2 * j12 - f1 * j22) / det) + e2 * ((f1 * j21 - f2 * j11) / det);
+	double step_length = step.length();
+	if (step_length > dt) {
+		step = step * (dt / step_length);
+	}
+	next = pos + step;
+	return true;
+}
+
 /*
 	Performs a Runge Kutta 4 Step in direction u.
 	u is needed for the case when the wind direction and the gradient point in opposite directions.
@@ -386,16 +1072,18 @@ Vec3d  JetStream::PredictorStepRK4Inverse(const Vec3d& pos, double dt) const {
 	u is the projection of the gradient on the plane perpendicular to v.
 */
 Vec3d JetStream::CorrectorStepRK4(const Vec3d& pos, const double& dt) const {
+	// The first stages of both RK4 integrations are at pos and are sampled together.
+	auto [gradient, direction] = SampleTraceFields<GRADIENT, DIRECTION>(pos);
+	Vec3d k1 = gradient;
+	Vec3d v1_normalized = direction;
 
-	Vec3d k1 = grad_wind_magnitude_->Sample(pos);
-	Vec3d k2 = grad_wind_magnitude_->Sample(pos + k1 * (dt / 2));
-	Vec3d k3 = grad_wind_magnitude_->Sample(pos + k2 * (dt / 2));
-	Vec3d k4 = grad_wind_magnitude_->Sample(pos + k3 * dt);
+	Vec3d k2 = SampleWindMagnitudeGradient(pos + k1 * (dt / 2));
+	Vec3d k3 = SampleWindMagnitudeGradient(pos + k2 * (dt / 2));
+	Vec3d k4 = SampleWindMagnitudeGradient(pos + k3 * dt);
 	Vec3d g = (k1 / 6 + k2 / 3 + k3 / 3 + k4 / 6);
-	Vec3d v1_normalized = wind_direction_normalized_->Sample(pos);
-	Vec3d v2_normalized = wind_direction_normalized_->Sample(pos + v1_normalized * (dt / 2));
-	Vec3d v3_normalized = wind_direction_normalized_->Sample(pos + v2_normalized * (dt / 2));
-	Vec3d v4_normalized = wind_direction_normalized_->Sample(pos + v3_normalized * dt);
+	Vec3d v2_normalized = SampleWindDirection(pos + v1_normalized * (dt / 2));
+	Vec3d v3_normalized = SampleWindDirection(pos + v2_normalized * (dt / 2));
+	Vec3d v4_normalized = SampleWindDirection(pos + v3_normalized * dt);
 	Vec3d v = (v1_normalized / 6 + v2_normalized / 3 + v3_normalized / 3 + v4_normalized / 6);
 
 	Vec3d u = g - v * g.dot(v);
@@ -415,13 +1103,16 @@ bool JetStream::ConditionDomain(const Vec3d& point) const {
 	double ps = point[2];
 
 	bool condition = (lon >= 0 && lon < res[0]) && (lat >= 0 && lat < res[1]) && (ps >= jet_params_.ps_min_tracing && ps <= jet_params_.ps_max_tracing);
+	if (jet_params_.hemisphere != HEMISPHERE::BOTH) {
+		const Vec2d latitude_range = GetLatitudeRange();
+		condition = condition && lat >= latitude_range[0] && lat <= latitude_range[1];
+	}
 	return condition;
 }
 /*
   Condition that the Jet core is only allowed to stay for max_steps_below_speed_thresh steps below threshold.
 */
-bool JetStream::ConditionWindMagnitude(const Vec3d& point, int& count) const {
-	float wind_mag = wind_magnitude_->Sample(point);
+bool JetStream::ConditionWindMagnitude(const float& wind_mag, int& count) const {
 	bool condition = wind_mag >= jet_params_.wind_speed_threshold;
 	if (!condition) {
 		count++;
@@ -439,6 +1130,7 @@ bool JetStream::ConditionWindMagnitude(const Vec3d& point, int& count) const {
 LineCollection JetStream::FilterFalsePositives(const LineCollection& jet) const {
 	std::vector<Line3d> jet_vec = jet.GetLinesInVectorOfVector();
 	std::vector<Line3d> result;
+	std::vector<size_t> result_ids;
 	for (int i = 0; i < jet_vec.size(); i++) {
 		if (jet_vec[i].size() == 0) { continue; }
 		Vec3d start_point_3d = jet_vec[i][0];
@@ -460,18 +1152,16 @@ LineCollection JetStream::FilterFalsePositives(const LineCollection& jet) const
 		}
 		if (largest_ver_dist > 100 && largest_horiz_dist < 10) { continue; }
 		result.push_back(jet_vec[i]);
+		if (!jet.GetLineIds().empty()) {
+			result_ids.push_back(jet.GetLineIds()[i]);
+		}
 	}
 	LineCollection res = LineCollection();
 	res.SetData(result);
+	res.SetLineIds(result_ids);
 	return res;
 }
 
-void JetStream::UpdateKdTree(const Line3d& new_line) {
-
-	jet_point_cloud.pts.insert(jet_point_cloud.pts.end(), new_line.begin(), new_line.end());
-	jet_kd_tree->buildIndex();
-}
-
 Line3d JetStream::FindPointsWithinRadius(const KdTree3d* kd_tree, const PointCloud3d& point_cloud, const double& radius, const Vec3d& point) const {
 	std::vector<std::pair<size_t, double> >  ret_matches;
 	nanoflann::SearchParams params;
@@ -489,13 +1179,13 @@ Line3d JetStream::FindPointsWithinRadius(const KdTree3d* kd_tree, const PointClo
 	}
 }
 
-Vec3d JetStream::FindClosestJetPoint(const double& radius, const Vec3d& point) const {
-	std::vector<std::pair<size_t, double> >  ret_matches;
-	nanoflann::SearchParams params;
-	params.sorted = true;
-	const size_t n_matches = jet_kd_tree->radiusSearch(&point[0], radius, ret_matches, params);
-	if (ret_matches.size() > 0) {
-		return jet_point_cloud.pts[ret_matches[0].first];
+/*
+	Returns the closest point of the committed jet core lines with a squared distance smaller than radius, or (-1, -1, -1) if there is none.
+*/
+Vec3d JetStream::FindClosestJetPoint(const PointHashGrid& jet_point_grid, const double& radius, const Vec3d& point) const {
+	Vec3d closest;
+	if (jet_point_grid.FindClosest(point, radius, closest)) {
+		return closest;
 	}
 	else {
 		return Vec3d({ -1, -1, -1 });
@@ -1,12 +1,31 @@
 ﻿#pragma once
 #include <mutex>
 
+#include "data_catalog.hpp"
 #include "era_grid.hpp"
+#include "field_cache.hpp"
 #include "line_collection.hpp"
+#include "multi_sampler.hpp"
+#include "point_grid.hpp"
+#include "seed_batch.hpp"
+#include "seed_queue.hpp"
 
 class JetStream
 {
 public:
+	/*
+		How the corrector moves a predicted position onto the ridge of the wind magnitude:
+		RK4 takes n_corrector_steps RK4 steps along the gradient projected on the plane normal to the wind direction,
+		CONVERGED takes the same steps but stops once a step moves less than corrector_tolerance,
+		NEWTON solves for the ridge point in the plane normal to the wind direction with Newton steps on the projected gradient.
+	*/
+	enum class CORRECTOR { RK4, CONVERGED, NEWTON };
+
+	/*
+		The latitudes which are traced. NORTH and SOUTH only search seeds in and trace within the hemisphere, the equator belongs to both.
+	*/
+	enum class HEMISPHERE { BOTH, NORTH, SOUTH };
+
 	struct JetParameters {
 		//Changable by user
 		int n_predictor_steps = 1;//1
@@ -16,6 +35,20 @@ public:
 		double integration_stepsize = 0.04;//0.05
 		double ps_min_val = 190;//225
 		double ps_max_val = 350;//320
+		bool load_level_range = false; // Only loads the model levels which can reach the tracing pressure band.
+		bool use_field_cache = false; // Reads the derived fields from the cache in the preprocessing directory, writes them if not cached yet.
+		bool resample_to_ps_axis = false; // Resamples the fields used for tracing onto the regular pressure axis within the tracing band.
+		bool adaptive_stepsize = false; // The predictor uses Dormand-Prince 5(4) steps with step size control instead of RK4 steps of integration_stepsize.
+		double adaptive_tolerance = 1e-3; // Largest local error estimate of an adaptive predictor step.
+		double min_stepsize = 0.01; // Bounds of the adaptive predictor step size.
+		double max_stepsize = 0.5;
+		double max_vertex_spacing = 0; // Segments of the core lines longer than this (index coordinates) are subdivided, 0 keeps the traced vertices.
+		CORRECTOR corrector = CORRECTOR::RK4;
+		double corrector_tolerance = 1e-3; // The CONVERGED and NEWTON correctors stop once a step is shorter than this. At most n_corrector_steps steps are taken.
+		HEMISPHERE hemisphere = HEMISPHERE::BOTH;
+		bool temporal_tracking = false; // Projects the core lines of the previous time step onto the current ridge and only traces the seeds they do not cover.
+		int tracking_corrector_steps = 25; // Maximal number of corrector steps per vertex of a projected line.
+		double tracking_stepsize = 0.5; // Initial corrector step size for the projected lines, which is halved each time a step crosses the ridge.
 
 		//Not Changable
 		double split_merge_threshold = 0.1;
@@ -26,32 +59,64 @@ public:
 		double kdtree_radius = 5.5; //20
   };
 
-	struct WindMagComparator {
-		EraScalarField3f* wind_magnitude;
-		std::vector<float> ps_axis_values;
-		Vec3d ToDomainCoordinates(Vec3d& p) const {
-			return Vec3d({ p[0], p[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values, (float)p[2], true) });
-		}
-		bool operator() (Vec3d a, Vec3d b) const {
-			return wind_magnitude->Sample(ToDomainCoordinates(a)) > wind_magnitude->Sample(ToDomainCoordinates(b));
-		};
+	/*
+		The fields read from the source file of a time step: U, V, OMEGA, T and the vertical coordinate of the model levels.
+		If the derived fields were read from the field cache, cached_fields holds them and fields is empty.
+	*/
+	struct SourceFields {
+		size_t time;
+		std::vector<RegScalarField3f*> fields;
+		HybridPressure* pressure;
+		bool latitude_ascending = true;
+		FieldCache::Fields cached_fields;
 	};
 
-	enum class HEMISPHERE { BOTH, NORTH, SOUTH };
+	/*
+		Difference of the wind magnitude between the resampled field and the field on the model levels, sampled at the cell centers of the resampled field.
+	*/
+	struct ResamplingDifference {
+		double max = 0;
+		double sum = 0;
+		size_t count = 0;
+	};
+
+	/*
+		Number of corrections of predicted positions and the number of corrector steps they took, of all seeds traced.
+	*/
+	struct CorrectorStatistics {
+		size_t corrections = 0;
+		size_t steps = 0;
+	};
 
-	JetStream(const size_t& time, const JetParameters& jet_params, const bool& ps3d_preprocessed);
+	JetStream(const size_t& time, const DataCatalog& catalog, const JetParameters& jet_params);
+	// Derives the wind fields from already loaded source fields. Takes ownership of the source fields.
+	JetStream(const SourceFields& source_fields, const DataCatalog& catalog, const JetParameters& jet_params);
 	~JetStream();
+
+	static SourceFields LoadSourceFields(const size_t& time, const DataCatalog& catalog, const JetParameters& jet_params);
+	static FieldCache::Key GetFieldCacheKey(const JetParameters& jet_params);
 	
 	void DeletePreviousJet();
 	void GenerateJetSeeds();
 
 	const LineCollection& GetJetCoreLines();
 	const size_t GetTime() const {return time_;}
+	const ResamplingDifference& GetResamplingDifference() const { return resampling_difference_; }
+	const CorrectorStatistics& GetCorrectorStatistics() const { return corrector_statistics_; }
 
 	void SetPreviousJet(JetStream *previous_jet){previous_jet_ = previous_jet; }
 
 private:
-	const bool ps3d_preprocessed_;
+	/*
+		The fields used for tracing, in this order. TraceSampler samples any subset of them at a position with a single level search,
+		ResampledTraceSampler with a single trilinear weight computation if the fields are resampled to the pressure axis.
+	*/
+	static constexpr size_t DIRECTION = 0;
+	static constexpr size_t GRADIENT = 1;
+	static constexpr size_t MAGNITUDE = 2;
+	typedef MultiSampler<EraLocator, EraVectorField3f, EraVectorField3f, EraScalarField3f> TraceSampler;
+	typedef MultiSampler<RegScalarField3f, RegVectorField3f, RegVectorField3f, RegScalarField3f> ResampledTraceSampler;
+
 	LineCollection jet_core_lines_;
 	JetStream* previous_jet_;
 
@@ -60,11 +125,22 @@ private:
 	EraVectorField3f* grad_wind_magnitude_;
 	EraScalarField3f* wind_magnitude_;
 	EraScalarField3f* wind_magnitude_smooth_;
-	RegScalarField3f* ps3d_;
+	HybridPressure* pressure_;
+	// Whether the latitude index runs from south to north, as in the source file.
+	bool latitude_ascending_;
+	EraLocator era_locator_;
+	TraceSampler* trace_sampler_;
+	// The fields used for tracing on the regular pressure axis, only set if jet_params_.resample_to_ps_axis is set.
+	RegVectorField3f* wind_direction_resampled_;
+	RegVectorField3f* grad_wind_magnitude_resampled_;
+	RegScalarField3f* wind_magnitude_resampled_;
+	ResampledTraceSampler* resampled_trace_sampler_;
+	ResamplingDifference resampling_difference_;
+	CorrectorStatistics corrector_statistics_;
 	std::vector<float> ps_axis_values_;
-	KdTree3d* jet_kd_tree;
-	PointCloud3d jet_point_cloud;
 	Line3d _seeds;
+	// The id of the next new core line with temporal_tracking, see line_ids_per_time_step.
+	size_t next_line_id_;
 
 	bool _usePreviousTimeStep;
 	bool _usePreprocessedPreviousJet;
@@ -74,36 +150,81 @@ private:
 		double distance;
 		Vec3d previous;
 	};
+	/*
+		A jet core line traced from a seed against the core lines committed so far.
+	*/
+	struct SeedTrace {
+		Line3d jet;
+		// Positions at which the tracing checked for a merge with the committed core lines, in index coordinates.
+		Line3d merge_checks;
+		// Indices of the seeds near the traced positions.
+		std::vector<size_t> passed_seeds;
+		// False if the trace stopped early, because it passed an earlier seed of its batch or the trace of an earlier seed passed its seed.
+		bool complete = true;
+		// The number of points in the grid of committed lines when the trace started.
+		size_t first_jet_point = 0;
+		CorrectorStatistics corrector_statistics;
+	};
 	size_t time_;
 	const JetParameters jet_params_;
-	WindMagComparator wind_magnitude_comparator_;
 
+	void ResampleToPressureAxis();
 	void ComputeJetCoreLines();
 	Line3d GetPreviousTimeStepSeeds();
-	std::vector<Line3d> FindJet(Line3d& seeds);
-
-	void Trace(Line3d& line, std::set<Vec3d, decltype(wind_magnitude_comparator_)>& seeds_set, KdTree3d* seeds_kd_tree, PointCloud3d& seeds_point_cloud, bool inverse);
-	void RemoveWrongStartUps(Line3d& jet_lines) const;
-	void CutWeakEndings(Line3d& jet);
-
-	Vec3d PredictorStepRK4(const Vec3d& pos, double dt) const;
-	Vec3d PredictorStepRK4Inverse(const Vec3d& pos, double dt) const;
+	std::vector<Line3d> TrackJet(Line3d& seeds, std::vector<size_t>& line_ids);
+	std::vector<Line3d> FindJet(Line3d& seeds, const std::vector<Line3d>& committed);
+	std::vector<Line3d> CutAtMerges(const Line3d& line, const PointHashGrid& point_grid) const;
+	Vec2d GetLatitudeRange() const;
+
+	SeedTrace TraceSeed(const Vec3d& seed, const int& rank, SeedBatch& batch, const PointOccupancyGrid& seeds_grid, const PointHashGrid& jet_point_grid) const;
+	void Trace(SeedTrace& trace, const int& rank, SeedBatch& batch, const PointOccupancyGrid& seeds_grid, const PointHashGrid& jet_point_grid, bool inverse) const;
+	bool MergesWith(const SeedTrace& trace, const PointHashGrid& point_grid) const;
+	void AddCorrectorStatistics(const CorrectorStatistics& statistics);
+	void RemoveWrongStartUps(Line3d& jet_lines, CorrectorStatistics& statistics) const;
+	void CutWeakEndings(Line3d& jet) const;
+
+	Vec3d PredictorStepRK4(const Vec3d& pos, const Vec3d& k1, double dt) const;
+	Vec3d PredictorStepRK4Inverse(const Vec3d& pos, const Vec3d& k1, double dt) const;
+	Vec3d PredictorStepDormandPrince(const Vec3d& pos, const Vec3d& k1, const double& sign, double& dt, double& taken_dt) const;
 	Vec3d CorrectorStepRK4(const Vec3d& pos, const double& dt) const;
-	Vec3d PredictorCorrectorStep(const Vec3d& pos) const;
-	Vec3d InversePredictorCorrectorStep(const Vec3d& pos) const;
+	bool CorrectorStepNewton(const Vec3d& pos, const double& dt, Vec3d& next) const;
+	Vec3d Correct(const Vec3d& pos, const double& dt, CorrectorStatistics& statistics) const;
+	Vec3d ProjectOntoRidge(const Vec3d& pos, CorrectorStatistics& statistics) const;
+	void ProjectVertices(const std::vector<size_t>& vertices, Points3d& points, std::vector<uint8_t>& valid);
+	Vec3d PredictorCorrectorStep(const Vec3d& pos, const Vec3d& direction, double& step_size, CorrectorStatistics& statistics) const;
+	Vec3d InversePredictorCorrectorStep(const Vec3d& pos, const Vec3d& direction, double& step_size, CorrectorStatistics& statistics) const;
+	void SubdivideLongSegments(Line3d& line) const;
 
 	bool ConditionDomain(const Vec3d& point) const;
-	bool ConditionWindMagnitude(const Vec3d& point, int& count) const;
+	bool ConditionWindMagnitude(const float& wind_mag, int& count) const;
 
 	LineCollection FilterFalsePositives(const LineCollection& jet) const;
 
 	/*
 		Helper functions.
 	*/
-	void UpdateKdTree(const Line3d& new_line);
-	Vec3d FindClosestJetPoint(const double& radius, const Vec3d& point) const;
+	Vec3d FindClosestJetPoint(const PointHashGrid& jet_point_grid, const double& radius, const Vec3d& point) const;
 	Line3d FindPointsWithinRadius(const KdTree3d* kd_tree, const PointCloud3d& point_cloud, const double& radius, const Vec3d& point) const;
 
+	/*
+		Samples the trace fields with the indices TFields at pos, e.g. SampleTraceFields<DIRECTION, MAGNITUDE>(pos).
+	*/
+	template<size_t... TFields>
+	std::tuple<TraceSampler::TValue<TFields>...> SampleTraceFields(const Vec3d& pos) const {
+		if (resampled_trace_sampler_ != nullptr) {
+			return resampled_trace_sampler_->Sample<TFields...>(pos);
+		}
+		return trace_sampler_->Sample<TFields...>(pos);
+	}
+	Vec3d SampleWindDirection(const Vec3d& pos) const {
+		return std::get<0>(SampleTraceFields<DIRECTION>(pos));
+	}
+	Vec3d SampleWindMagnitudeGradient(const Vec3d& pos) const {
+		return std::get<0>(SampleTraceFields<GRADIENT>(pos));
+	}
+	float SampleWindMagnitude(const Vec3d& pos) const {
+		return std::get<0>(SampleTraceFields<MAGNITUDE>(pos));
+	}
 	double GetLineDistance(const Line3d& line) const {
 		double res = 0;
 		for (int i = 1; i < line.size(); i++) {
@@ -112,10 +233,10 @@ private:
 		}
 		return res;
 	}
-	Vec3d ToIndexCoordinates(Vec3d& p) const {
+	Vec3d ToIndexCoordinates(const Vec3d& p) const {
 		return Vec3d({ p[0], p[1], CoordinateConverter::IndexOfValueInArray(ps_axis_values_, (float)p[2], true) });
 	}
-	Vec3d ToDomainCoordinates(Vec3d& p) const {
+	Vec3d ToDomainCoordinates(const Vec3d& p) const {
 		return Vec3d({ p[0], p[1], CoordinateConverter::ValueOfIndexInArray(ps_axis_values_, (float)p[2], true) });
 	}
 };
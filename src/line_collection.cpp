@@ -65,6 +65,7 @@ void LineCollection::Clear() {
 		delete attributes_[i];
 	}
 	attributes_.clear();
+	line_ids_.clear();
 }
 size_t LineCollection::GetNumberOfPointsOfLine(const size_t& line_nr) const {
 	return (size_t)std::round(lines_[line_nr + 1]);
@@ -93,6 +94,14 @@ const std::vector<float>& LineCollection::GetAttributeByName(const std::string&
   return *(std::vector<float> *)nullptr;
 }
 
+void LineCollection::SetLineIds(const std::vector<size_t>& line_ids) {
+	line_ids_ = line_ids;
+}
+
+const std::vector<size_t>& LineCollection::GetLineIds() const {
+	return line_ids_;
+}
+
 std::vector<std::vector<Vec3d>> LineCollection::GetLinesInVectorOfVector() const
 {
 	std::vector<std::vector<Vec3d>> result;
@@ -132,6 +141,12 @@ void LineCollection::ExportTxtFile(const char* path, const std::vector<float>& p
                   "\n";
     }
 	}
+	if (!line_ids_.empty()) {
+		file << "LINE_IDS:\n";
+		for (size_t i = 0; i < line_ids_.size(); i++) {
+			file << std::to_string(line_ids_[i]) + "\n";
+		}
+	}
 	file.close();
 }
 
@@ -179,6 +194,16 @@ void LineCollection::ExportVtp(const char* path, const std::vector<float>& ps_ax
 	file << "<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n";
 	file << "  <PolyData>\n";
 	file << "    <Piece NumberOfPoints=\"" << GetTotalNumberOfPoints() << "\" NumberOfLines=\"" << GetNumberOfLines() << "\">\n";
+	if (!line_ids_.empty()) {
+		file << "      <CellData Scalars=\"LineId\">\n";
+		file << "        <DataArray type=\"Int64\" Name=\"LineId\" format=\"ascii\">\n";
+		file << "          ";
+		for (size_t i = 0; i < line_ids_.size(); i++) {
+			file << line_ids_[i] << (i != line_ids_.size() - 1 ? " " : "\n");
+		}
+		file << "        </DataArray>\n";
+		file << "      </CellData>\n";
+	}
 	file << "      <Points>\n";
 	file << "        <DataArray type=\"Float64\" Name=\"Points\" NumberOfComponents=\"3\" format=\"ascii\">\n";
 	file << "          " << points;
@@ -27,6 +27,9 @@ public:
 	std::vector<std::vector<Vec3d>> GetLinesInVectorOfVector() const;
 	std::vector<Vec3d> GetAllPointsInVector() const;
 	const std::vector<float>& GetAttributeByName(const std::string& attribute_name) const;
+	// One id per line, which identifies the line across time steps. Empty if the lines have no ids. SetData clears the ids.
+	void SetLineIds(const std::vector<size_t>& line_ids);
+	const std::vector<size_t>& GetLineIds() const;
 
 	void ExportTxtFile(const char* path, const std::vector<float>& ps_axis_values) const;
 	void ExportVtp(const char* path, const std::vector<float>& ps_axis_values) const;
@@ -36,6 +39,7 @@ public:
 private:
 	std::vector<float> lines_;
 	std::vector<Attribute*> attributes_;
+	std::vector<size_t> line_ids_;
 
 	size_t n_lines_;
 };
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include <tuple>
+#include <utility>
+
+#include "math.hpp"
+
+/*
+	Samples several fields, which are defined on the same grid, at the same position.
+	TLocator computes the interpolation corners and weights of a position once with Locate(pos), each field evaluates them with Sample(location).
+	This works for EraGrid fields with an EraLocator and for RegularGrid fields with one of the fields as locator.
+	The fields to sample are selected at compile time by their index in TFields, e.g. Sample<0, 2>(pos) returns the values of the first and third field.
+*/
+template<typename TLocator, typename... TFields>
+class MultiSampler
+{
+public:
+	template<size_t TIndex>
+	using TField = std::tuple_element_t<TIndex, std::tuple<TFields...>>;
+	template<size_t TIndex>
+	using TValue = decltype(std::declval<const TField<TIndex>&>().Sample(std::declval<Vec3d>()));
+
+	MultiSampler(const TLocator* locator, const TFields*... fields) :
+		locator_(locator),
+		fields_(fields...)
+	{
+	}
+
+	template<size_t... TIndices>
+	std::tuple<TValue<TIndices>...> Sample(const Vec3d& pos) const {
+		auto location = locator_->Locate(pos);
+		return std::tuple<TValue<TIndices>...>(std::get<TIndices>(fields_)->Sample(location)...);
+	}
+
+private:
+	const TLocator* locator_;
+	std::tuple<const TFields*...> fields_;
+};
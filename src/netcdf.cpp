@@ -35,17 +35,13 @@ const NetCDF::Info::Variable& NetCDF::Info::GetVariableByName(const std::string&
 	throw "Variable name '" + name + "' not found.";
 }
 
-bool NetCDF::ReadInfo(const std::string& path, Info& info)
+bool NetCDF::ReadInfo(const int& ncid, Info& info)
 {
-	int status, ncid, unlimdimid;
-
-	// open the file
-	status = nc_open(path.c_str(), NC_NOWRITE, &ncid);
-	if (status != NC_NOERR) { return false; } //handle_error(status);
+	int status, unlimdimid;
 
 	// read basic counters
 	status = nc_inq(ncid, &info.NumDimensions, &info.NumVariables, &info.NumAttributes, &unlimdimid);
-	if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+	if (status != NC_NOERR) { return false; } //handle_error(status);
 
 	// read all dimensions
 	for (int dimid = 0; dimid < info.NumDimensions; ++dimid)
@@ -68,7 +64,7 @@ bool NetCDF::ReadInfo(const std::string& path, Info& info)
 		int var_numatts;
 
 		status = nc_inq_var(ncid, varid, var_name, &var_type, &var_ndims, var_dimids, &var_numatts);
-		if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+		if (status != NC_NOERR) { return false; } //handle_error(status);
 
 		Info::Variable var(std::string(var_name), varid, (Info::EType)var_type);
 		for (int i = 0; i < var_ndims; ++i)
@@ -82,11 +78,11 @@ bool NetCDF::ReadInfo(const std::string& path, Info& info)
 			size_t att_lenp;
 
 			nc_inq_attname(ncid, varid, attid, att_name);
-			if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+			if (status != NC_NOERR) { return false; } //handle_error(status);
 			nc_inq_atttype(ncid, varid, att_name, &att_type);
-			if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+			if (status != NC_NOERR) { return false; } //handle_error(status);
 			nc_inq_attlen(ncid, varid, att_name, &att_lenp);
-			if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+			if (status != NC_NOERR) { return false; } //handle_error(status);
 
 			switch (att_type)
 			{
@@ -107,24 +103,71 @@ bool NetCDF::ReadInfo(const std::string& path, Info& info)
 
 			Info::Attribute attr(att_name, attid, (Info::EType)att_type, att_lenp);
 			nc_get_att(ncid, varid, att_name, attr.GetValue());
-			if (status != NC_NOERR) { nc_close(ncid); return false; } //handle_error(status);
+			if (status != NC_NOERR) { return false; } //handle_error(status);
 			var.Attributes.push_back(attr);
 		}
 
 		info.Variables.push_back(var);
 	}
-	nc_close(ncid);
+	return true;
+}
+
+bool NetCDF::ReadInfo(const std::string& path, Info& info)
+{
+	File file(path);
+	if (!file.IsOpen()) return false;
+	info = file.GetInfo();
 	return true;
 }
 
 RegScalarField2f* NetCDF::ImportScalarField2f(const std::string& path, const std::string& varname, const std::string& dimXname, const std::string& dimYname)
 {
+	File file(path);
+	return file.ImportScalarField2f(varname, dimXname, dimYname);
+}
+
+RegScalarField3f* NetCDF::ImportScalarField3f(const std::string& path, const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname)
+{
+	File file(path);
+	return file.ImportScalarField3f(varname, dimXname, dimYname, dimZname);
+}
+
+bool NetCDF::ImportFloat(const std::string& path, const std::string& varname, float& output)
+{
+	File file(path);
+	return file.ImportFloat(varname, output);
+}
+
+bool NetCDF::ImportFloatArray(const std::string& path, const std::string& varname, std::vector<float>& floatArray)
+{
+	File file(path);
+	return file.ImportFloatArray(varname, floatArray);
+}
+
+NetCDF::File::File(const std::string& path) : mPath(path), mNcid(-1), mIsOpen(false)
+{
+	// open the file
+	int status = nc_open(path.c_str(), NC_NOWRITE, &mNcid);
+	if (status != NC_NOERR) { return; }
+
 	// get the info object
-	NetCDF::Info info;
-	if (!ReadInfo(path, info)) return NULL;
+	if (!ReadInfo(mNcid, mInfo)) { nc_close(mNcid); return; }
+	mIsOpen = true;
+}
+
+NetCDF::File::~File()
+{
+	if (mIsOpen) {
+		nc_close(mNcid);
+	}
+}
+
+RegScalarField2f* NetCDF::File::ImportScalarField2f(const std::string& varname, const std::string& dimXname, const std::string& dimYname)
+{
+	if (!mIsOpen) return NULL;
 
 	// read the resolution from the info object
-	const NetCDF::Info::Variable& variable = info.GetVariableByName(varname);
+	const NetCDF::Info::Variable& variable = mInfo.GetVariableByName(varname);
 	size_t resX = variable.GetDimensionByName(dimXname).GetLength();
 	size_t resY = variable.GetDimensionByName(dimYname).GetLength();
 
@@ -136,49 +179,49 @@ RegScalarField2f* NetCDF::ImportScalarField2f(const std::string& path, const std
 		return NULL;
 	}
 
-	// open the file
-	int status, ncid;
-	status = nc_open(path.c_str(), NC_NOWRITE, &ncid);
-	if (status != NC_NOERR) { return NULL; }
-
-	// read the bounds if not provided
+	// read the bounds
+	const std::vector<float>* dimX = GetFloatArray(dimXname);
+	const std::vector<float>* dimY = GetFloatArray(dimYname);
+	if (dimX == NULL || dimY == NULL) return NULL;
 	BoundingBox2d domain;
-	std::vector<float> dimX, dimY;
-	ImportFloatArray(path, dimXname, dimX);
-	ImportFloatArray(path, dimYname, dimY);
-	domain.ExpandByPoint(Vec2d({ dimX.front(), dimY.front() }));
-	domain.ExpandByPoint(Vec2d({ dimX.back(), dimY.back() }));
-
-	// allocate the scalar field
-	RegScalarField2f* field = new RegScalarField2f(Vec2i({ (int)resX, (int)resY }), domain);
+	domain.ExpandByPoint(Vec2d({ dimX->front(), dimY->front() }));
+	domain.ExpandByPoint(Vec2d({ dimX->back(), dimY->back() }));
 
-	if (vartype == Info::EType::FLOAT)
-	{
-		float* rawdata = field->GetData().data();
-		status = nc_get_var_float(ncid, varid, rawdata);
-		if (status != NC_NOERR) { delete field; nc_close(ncid); return NULL; }
-	}
-	else {
+	if (vartype != Info::EType::FLOAT) {
 		printf("Incompatible format.\n");
-		delete field;
-		nc_close(ncid);
 		return NULL;
 	}
-	nc_close(ncid);
+
+	// allocate the scalar field
+	RegScalarField2f* field = new RegScalarField2f(Vec2i({ (int)resX, (int)resY }), domain);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	float* rawdata = field->GetData().data();
+	int status = nc_get_var_float(mNcid, varid, rawdata);
+	if (status != NC_NOERR) { delete field; return NULL; }
 	return field;
 }
 
-RegScalarField3f* NetCDF::ImportScalarField3f(const std::string& path, const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname)
+RegScalarField3f* NetCDF::File::ImportScalarField3f(const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname)
 {
-	// get the info object
-	NetCDF::Info info;
-	if (!ReadInfo(path, info)) return NULL;
+	if (!mIsOpen) return NULL;
+	size_t resZ = mInfo.GetVariableByName(varname).GetDimensionByName(dimZname).GetLength();
+	return ImportScalarField3f(varname, dimXname, dimYname, dimZname, 0, resZ);
+}
+
+RegScalarField3f* NetCDF::File::ImportScalarField3f(const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname, const size_t& z_start, const size_t& z_count)
+{
+	if (!mIsOpen) return NULL;
 
 	// read the resolution from the info object
-	const NetCDF::Info::Variable& variable = info.GetVariableByName(varname);
+	const NetCDF::Info::Variable& variable = mInfo.GetVariableByName(varname);
 	size_t resX = variable.GetDimensionByName(dimXname).GetLength();
 	size_t resY = variable.GetDimensionByName(dimYname).GetLength();
 	size_t resZ = variable.GetDimensionByName(dimZname).GetLength();
+	if (z_count == 0 || z_start + z_count > resZ) {
+		printf("Invalid level range!");
+		return NULL;
+	}
 
 	// get meta information on the variable
 	int varid = variable.GetID();
@@ -188,50 +231,50 @@ RegScalarField3f* NetCDF::ImportScalarField3f(const std::string& path, const std
 		return NULL;
 	}
 
-	// open the file
-	int status, ncid;
-	status = nc_open(path.c_str(), NC_NOWRITE, &ncid);
-	if (status != NC_NOERR) { return NULL; }
-
-	// read the bounds if not provided
+	// read the bounds
+	const std::vector<float>* dimX = GetFloatArray(dimXname);
+	const std::vector<float>* dimY = GetFloatArray(dimYname);
+	const std::vector<float>* dimZ = GetFloatArray(dimZname);
+	if (dimX == NULL || dimY == NULL || dimZ == NULL) return NULL;
 	BoundingBox3d domain;
-	std::vector<float> dimX, dimY, dimZ;
-	ImportFloatArray(path, dimXname, dimX);
-	ImportFloatArray(path, dimYname, dimY);
-	ImportFloatArray(path, dimZname, dimZ);
-	domain.ExpandByPoint(Vec3d({ dimX.front(), dimY.front(), dimZ.front() }));
-	domain.ExpandByPoint(Vec3d({ dimX.back(), dimY.back(), dimZ.back() }));
+	domain.ExpandByPoint(Vec3d({ dimX->front(), dimY->front(), (*dimZ)[z_start] }));
+	domain.ExpandByPoint(Vec3d({ dimX->back(), dimY->back(), (*dimZ)[z_start + z_count - 1] }));
 
-	// allocate the scalar field
-	RegScalarField3f* field = new RegScalarField3f(Vec3i({ (int)resX, (int)resY, (int)resZ }), domain);
-
-	if (vartype == Info::EType::FLOAT)
-	{
-		float* rawdata = field->GetData().data();
-		status = nc_get_var_float(ncid, varid, rawdata);
-
-		if (status != NC_NOERR) { delete field; nc_close(ncid); return NULL; }
-
-	}
-	else {
+	if (vartype != Info::EType::FLOAT) {
 		printf("Incompatible format.\n");
-		delete field;
-		nc_close(ncid);
 		return NULL;
 	}
-	nc_close(ncid);
 
+	// the hyperslab covers x and y completely, the z range partially and the first entry of any other dimension (e.g. time)
+	std::vector<size_t> start(variable.Dimensions.size(), 0);
+	std::vector<size_t> count(variable.Dimensions.size(), 1);
+	for (size_t d = 0; d < variable.Dimensions.size(); ++d) {
+		const std::string& dim_name = variable.Dimensions[d].GetName();
+		if (dim_name == dimXname || dim_name == dimYname) {
+			count[d] = variable.Dimensions[d].GetLength();
+		}
+		else if (dim_name == dimZname) {
+			start[d] = z_start;
+			count[d] = z_count;
+		}
+	}
+
+	// allocate the scalar field
+	RegScalarField3f* field = new RegScalarField3f(Vec3i({ (int)resX, (int)resY, (int)z_count }), domain);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	float* rawdata = field->GetData().data();
+	int status = nc_get_vara_float(mNcid, varid, start.data(), count.data(), rawdata);
+	if (status != NC_NOERR) { delete field; return NULL; }
 	return field;
 }
 
-bool NetCDF::ImportFloat(const std::string& path, const std::string& varname, float& output)
+bool NetCDF::File::ImportFloat(const std::string& varname, float& output)
 {
-	// get the info object
-	NetCDF::Info info;
-	if (!ReadInfo(path, info)) return false;
+	if (!mIsOpen) return false;
 
 	// read the resolution from the info object
-	const NetCDF::Info::Variable& variable = info.GetVariableByName(varname);
+	const NetCDF::Info::Variable& variable = mInfo.GetVariableByName(varname);
 
 	// get meta information on the variable
 	int varid = variable.GetID();
@@ -241,68 +284,68 @@ bool NetCDF::ImportFloat(const std::string& path, const std::string& varname, fl
 		return false;
 	}
 
-	// open the file
-	int status, ncid;
-	status = nc_open(path.c_str(), NC_NOWRITE, &ncid);
-	if (status != NC_NOERR) { return false; }
-
-	// allocate the scalar field
+	std::lock_guard<std::mutex> lock(mMutex);
+	int status;
 	if (vartype == Info::EType::FLOAT) {
-		status = nc_get_var_float(ncid, varid, &output);
-		if (status != NC_NOERR) { nc_close(ncid); return false; }
+		status = nc_get_var_float(mNcid, varid, &output);
+		if (status != NC_NOERR) { return false; }
 	}
 	else if (vartype == Info::EType::DOUBLE) {
 		double output_double;
-		status = nc_get_var_double(ncid, varid, &output_double);
-		if (status != NC_NOERR) { nc_close(ncid); return false; }
+		status = nc_get_var_double(mNcid, varid, &output_double);
+		if (status != NC_NOERR) { return false; }
 		output = static_cast<float>(output_double);
 	}
-
-	nc_close(ncid);
 	return true;
 }
 
+bool NetCDF::File::ImportFloatArray(const std::string& varname, std::vector<float>& floatArray)
+{
+	const std::vector<float>* cached = GetFloatArray(varname);
+	if (cached == NULL) return false;
+	floatArray = *cached;
+	return true;
+}
 
-bool NetCDF::ImportFloatArray(const std::string& path, const std::string& varname, std::vector<float>& floatArray)
+/*
+	Returns the cached float array. On the first request, the array is read from the file. Returns NULL if the array can't be read.
+*/
+const std::vector<float>* NetCDF::File::GetFloatArray(const std::string& varname)
 {
-	// get the info object
-	NetCDF::Info info;
-	if (!ReadInfo(path, info)) return false;
+	if (!mIsOpen) return NULL;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto cached = mFloatArrays.find(varname);
+	if (cached != mFloatArrays.end()) {
+		return &cached->second;
+	}
 
 	// read the resolution from the info object
-	const NetCDF::Info::Variable& variable = info.GetVariableByName(varname);
+	const NetCDF::Info::Variable& variable = mInfo.GetVariableByName(varname);
 
 	// get meta information on the variable
 	int varid = variable.GetID();
 	Info::EType vartype = variable.GetType();
 	if (vartype != Info::EType::FLOAT && vartype != Info::EType::DOUBLE) {
 		printf("Unsupported format!");
-		return false;
+		return NULL;
 	}
 
-	// open the file
-	int status, ncid;
-	status = nc_open(path.c_str(), NC_NOWRITE, &ncid);
-	if (status != NC_NOERR) { return false; }
-
-	// allocate the scalar field
+	// allocate the array
+	int status;
 	size_t varlength = variable.Dimensions[0].GetLength();
+	std::vector<float> floatArray(varlength);
 	if (vartype == Info::EType::FLOAT) {
-		floatArray.resize(varlength);
-		float* rawdata = floatArray.data();
-		status = nc_get_var_float(ncid, varid, rawdata);
-		if (status != NC_NOERR) { nc_close(ncid); return false; }
+		status = nc_get_var_float(mNcid, varid, floatArray.data());
+		if (status != NC_NOERR) { return NULL; }
 	}
 	else if (vartype == Info::EType::DOUBLE) {
-		floatArray.resize(varlength);
-		float* rawdata = floatArray.data();
-		double* rawdbl = new double[varlength];
-		status = nc_get_var_double(ncid, varid, rawdbl);
+		std::vector<double> rawdbl(varlength);
+		status = nc_get_var_double(mNcid, varid, rawdbl.data());
+		if (status != NC_NOERR) { return NULL; }
 		for (size_t i = 0; i < varlength; ++i) {
-			rawdata[i] = (float)rawdbl[i];
+			floatArray[i] = (float)rawdbl[i];
 		}
-		if (status != NC_NOERR) { nc_close(ncid); return false; }
 	}
-	nc_close(ncid);
-	return true;
+	return &(mFloatArrays[varname] = std::move(floatArray));
 }
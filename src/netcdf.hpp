@@ -1,4 +1,6 @@
 ﻿#pragma once
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -101,6 +103,47 @@ public:
 		const Variable& GetVariableByName(const std::string& name) const;
 	};
 
+	/*
+		An opened nc file. The file is opened once and the info object is parsed once on construction.
+		Float arrays (e.g. the lon, lat and lev axes) are cached after the first read, such that all fields of a file can be imported without reopening it.
+		The netcdf library is not thread safe, that's why all reads on the same file are serialized.
+	*/
+	class File
+	{
+	public:
+		File(const std::string& path);
+		~File();
+
+		// Disable copy-constructor.
+		File(const File&) = delete;
+
+		bool IsOpen() const { return mIsOpen; }
+		const std::string& GetPath() const { return mPath; }
+		const Info& GetInfo() const { return mInfo; }
+
+		// imports a steady 2d scalar field
+		RegScalarField2f* ImportScalarField2f(const std::string& varname, const std::string& dimXname, const std::string& dimYname);
+		// imports a steady 3d scalar field
+		RegScalarField3f* ImportScalarField3f(const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname);
+		// imports the hyperslab [z_start, z_start + z_count) of the z dimension of a steady 3d scalar field
+		RegScalarField3f* ImportScalarField3f(const std::string& varname, const std::string& dimXname, const std::string& dimYname, const std::string& dimZname, const size_t& z_start, const size_t& z_count);
+
+		// imports a float value
+		bool ImportFloat(const std::string& varname, float& output);
+		// imports a float array. The array is cached, repeated imports don't access the file.
+		bool ImportFloatArray(const std::string& varname, std::vector<float>& output);
+
+	private:
+		const std::vector<float>* GetFloatArray(const std::string& varname);
+
+		std::string mPath;
+		int mNcid;
+		bool mIsOpen;
+		Info mInfo;
+		std::map<std::string, std::vector<float>> mFloatArrays;
+		std::mutex mMutex;
+	};
+
 	// reads the info object, desccribing the nc file
 	static bool ReadInfo(const std::string& path, Info& info);
 
@@ -113,4 +156,8 @@ public:
 	static bool ImportFloat(const std::string& path, const std::string& varname, float& output);
 	// imports a float array
 	static bool ImportFloatArray(const std::string& path, const std::string& varname, std::vector<float>& output);
+
+private:
+	// reads the info object of an already opened nc file
+	static bool ReadInfo(const int& ncid, Info& info);
 };
@@ -0,0 +1,238 @@
+﻿#pragma once
+#include <bitset>
+#include <cstdint>
+#include <unordered_map>
+
+#include "math.hpp"
+
+/*
+	Uniform hash grid over 3D points for fixed radius searches, to which points can be added at any time.
+	The cell size is the largest search radius, such that a search only visits the 3x3x3 cells around the searched point.
+	Adding n points costs O(n) and a search does not allocate memory.
+*/
+class PointHashGrid
+{
+public:
+	PointHashGrid(const double& cell_size) :
+		cell_size_(cell_size)
+	{
+	}
+
+	bool IsEmpty() const { return points_.empty(); }
+	size_t GetSize() const { return points_.size(); }
+
+	void Insert(const Line3d& points) {
+		for (const Vec3d& point : points) {
+			cells_[GetKey(GetCell(point))].push_back((uint32_t)points_.size());
+			points_.push_back(point);
+		}
+	}
+
+	/*
+		Finds the closest point with a squared distance smaller than squared_radius, like the radius search of the kd tree.
+		squared_radius has to be at most the squared cell size. Of points with equal distance, the one added first is returned.
+		Returns false if there is no such point.
+	*/
+	bool FindClosest(const Vec3d& point, const double& squared_radius, Vec3d& closest) const {
+		const Vec3i cell = GetCell(point);
+		double closest_distance = squared_radius;
+		uint32_t closest_index = UINT32_MAX;
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					auto found = cells_.find(GetKey(Vec3i({ cell[0] + dx, cell[1] + dy, cell[2] + dz })));
+					if (found == cells_.end()) continue;
+					for (const uint32_t& index : found->second) {
+						const Vec3d& candidate = points_[index];
+						double distance = 0;
+						for (int d = 0; d < 3; d++) {
+							distance += (point[d] - candidate[d]) * (point[d] - candidate[d]);
+						}
+						if (distance < closest_distance || (distance == closest_distance && closest_index != UINT32_MAX && index < closest_index)) {
+							closest_distance = distance;
+							closest_index = index;
+						}
+					}
+				}
+			}
+		}
+		if (closest_index == UINT32_MAX) {
+			return false;
+		}
+		closest = points_[closest_index];
+		return true;
+	}
+
+	/*
+		Returns true if a point which was added at or after first_index has a squared distance smaller than squared_radius.
+	*/
+	bool ContainsWithin(const Vec3d& point, const double& squared_radius, const size_t& first_index) const {
+		if (first_index >= points_.size()) {
+			return false;
+		}
+		const Vec3i cell = GetCell(point);
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					auto found = cells_.find(GetKey(Vec3i({ cell[0] + dx, cell[1] + dy, cell[2] + dz })));
+					if (found == cells_.end()) continue;
+					for (const uint32_t& index : found->second) {
+						if (index < first_index) continue;
+						const Vec3d& candidate = points_[index];
+						double distance = 0;
+						for (int d = 0; d < 3; d++) {
+							distance += (point[d] - candidate[d]) * (point[d] - candidate[d]);
+						}
+						if (distance < squared_radius) {
+							return true;
+						}
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+private:
+	double cell_size_;
+	Points3d points_;
+	// Indices of the points in each non empty cell.
+	std::unordered_map<uint64_t, std::vector<uint32_t>> cells_;
+
+	Vec3i GetCell(const Vec3d& point) const {
+		return Vec3i({ (int)std::floor(point[0] / cell_size_), (int)std::floor(point[1] / cell_size_), (int)std::floor(point[2] / cell_size_) });
+	}
+	// Packs the cell coordinates into 21 bits each.
+	static uint64_t GetKey(const Vec3i& cell) {
+		const uint64_t mask = (uint64_t(1) << 21) - 1;
+		return ((uint64_t)(cell[0] & mask) << 42) | ((uint64_t)(cell[1] & mask) << 21) | (uint64_t)(cell[2] & mask);
+	}
+};
+
+/*
+	Static grid of points on the unit cells of the index space, for radius searches with a fixed radius, e.g. the seeds of the tracing.
+	The cells of the bounding box of the points are marked in an occupancy bitmap. The points of the occupied cells are stored contiguously,
+	in order of the cells, and the rank of a cell in the bitmap gives its range. The cells which can contain points within the radius
+	are precomputed as a stencil of cell offsets, so a search visits a fixed set of cells and only allocates if the result grows.
+*/
+class PointOccupancyGrid
+{
+public:
+	/*
+		squared_radius is compared with the squared distance, like the radius search of the kd tree.
+	*/
+	PointOccupancyGrid(const Points3d& points, const double& squared_radius) :
+		points_(points),
+		squared_radius_(squared_radius),
+		box_min_(Vec3i({ 0, 0, 0 })),
+		box_size_(Vec3i({ 0, 0, 0 }))
+	{
+		if (points_.empty()) return;
+		Vec3i box_max = GetCell(points_[0]);
+		box_min_ = box_max;
+		for (const Vec3d& point : points_) {
+			Vec3i cell = GetCell(point);
+			for (int d = 0; d < 3; d++) {
+				box_min_[d] = std::min(box_min_[d], cell[d]);
+				box_max[d] = std::max(box_max[d], cell[d]);
+			}
+		}
+		box_size_ = box_max - box_min_ + Vec3i({ 1, 1, 1 });
+
+		const int64_t n_cells = (int64_t)box_size_[0] * box_size_[1] * box_size_[2];
+		occupied_.assign((size_t)(n_cells + 63) / 64, 0);
+		std::vector<int64_t> point_cells(points_.size());
+		for (size_t i = 0; i < points_.size(); i++) {
+			point_cells[i] = GetCellIndex(GetCell(points_[i]) - box_min_);
+			occupied_[point_cells[i] / 64] |= uint64_t(1) << (point_cells[i] % 64);
+		}
+		word_rank_.resize(occupied_.size());
+		uint32_t rank = 0;
+		for (size_t w = 0; w < occupied_.size(); w++) {
+			word_rank_[w] = rank;
+			rank += (uint32_t)PopCount(occupied_[w]);
+		}
+
+		cell_begin_.assign((size_t)rank + 1, 0);
+		for (const int64_t& cell_index : point_cells) {
+			cell_begin_[GetRank(cell_index) + 1]++;
+		}
+		for (size_t c = 1; c < cell_begin_.size(); c++) {
+			cell_begin_[c] += cell_begin_[c - 1];
+		}
+		point_indices_.resize(points_.size());
+		std::vector<uint32_t> fill(cell_begin_.begin(), cell_begin_.end() - 1);
+		for (size_t i = 0; i < points_.size(); i++) {
+			point_indices_[fill[GetRank(point_cells[i])]++] = (uint32_t)i;
+		}
+
+		// A cell offset is in the stencil if the closest points of the two cells are within the radius.
+		const int reach = (int)std::floor(std::sqrt(squared_radius_)) + 1;
+		for (int dz = -reach; dz <= reach; dz++) {
+			for (int dy = -reach; dy <= reach; dy++) {
+				for (int dx = -reach; dx <= reach; dx++) {
+					double gap_x = std::max(0, std::abs(dx) - 1);
+					double gap_y = std::max(0, std::abs(dy) - 1);
+					double gap_z = std::max(0, std::abs(dz) - 1);
+					if (gap_x * gap_x + gap_y * gap_y + gap_z * gap_z < squared_radius_) {
+						stencil_.push_back(Vec3i({ dx, dy, dz }));
+					}
+				}
+			}
+		}
+	}
+
+	/*
+		Appends the indices of the points with a squared distance smaller than the squared radius to indices.
+	*/
+	void FindWithinRadius(const Vec3d& point, std::vector<size_t>& indices) const {
+		if (points_.empty()) return;
+		const Vec3i cell = GetCell(point) - box_min_;
+		for (const Vec3i& offset : stencil_) {
+			const Vec3i neighbor = cell + offset;
+			if (neighbor[0] < 0 || neighbor[1] < 0 || neighbor[2] < 0 || neighbor[0] >= box_size_[0] || neighbor[1] >= box_size_[1] || neighbor[2] >= box_size_[2]) continue;
+			const int64_t cell_index = GetCellIndex(neighbor);
+			if ((occupied_[cell_index / 64] & (uint64_t(1) << (cell_index % 64))) == 0) continue;
+			const uint32_t rank = GetRank(cell_index);
+			for (uint32_t i = cell_begin_[rank]; i < cell_begin_[rank + 1]; i++) {
+				const Vec3d& candidate = points_[point_indices_[i]];
+				double distance = 0;
+				for (int d = 0; d < 3; d++) {
+					distance += (point[d] - candidate[d]) * (point[d] - candidate[d]);
+				}
+				if (distance < squared_radius_) {
+					indices.push_back(point_indices_[i]);
+				}
+			}
+		}
+	}
+
+private:
+	Points3d points_;
+	double squared_radius_;
+	Vec3i box_min_;
+	Vec3i box_size_;
+	// One bit per cell of the bounding box, x fastest.
+	std::vector<uint64_t> occupied_;
+	// Number of occupied cells before each word of occupied_.
+	std::vector<uint32_t> word_rank_;
+	// The points of the occupied cell with rank r are point_indices_[cell_begin_[r] ... cell_begin_[r + 1] - 1].
+	std::vector<uint32_t> cell_begin_;
+	std::vector<uint32_t> point_indices_;
+	std::vector<Vec3i> stencil_;
+
+	static Vec3i GetCell(const Vec3d& point) {
+		return Vec3i({ (int)std::floor(point[0]), (int)std::floor(point[1]), (int)std::floor(point[2]) });
+	}
+	int64_t GetCellIndex(const Vec3i& cell) const {
+		return ((int64_t)cell[2] * box_size_[1] + cell[1]) * box_size_[0] + cell[0];
+	}
+	// Returns the number of occupied cells before the cell.
+	uint32_t GetRank(const int64_t& cell_index) const {
+		const uint64_t below = occupied_[cell_index / 64] & ((uint64_t(1) << (cell_index % 64)) - 1);
+		return word_rank_[cell_index / 64] + (uint32_t)PopCount(below);
+	}
+	static int PopCount(const uint64_t& word) {
+		return (int)std::bitset<64>(word).count();
+	}
+};
@@ -1,6 +1,17 @@
 ﻿#pragma once
 #include "math.hpp"
 
+/*
+	The corners and weights of the multilinear interpolation at a position in a regular grid. Computed once by RegularGrid::Locate,
+	it can be used to sample any grid with the same resolution and domain.
+*/
+template<size_t TDimensions>
+struct RegularGridLocation {
+	static constexpr size_t NumCorners = size_t(1) << TDimensions;
+	int corner_index[NumCorners];
+	float weight[NumCorners];
+};
+
 // Base class for a field on a regular grid
 template<typename TValueType, size_t TDimensions>
 class RegularGrid
@@ -35,6 +46,22 @@ public:
 			Call with domain coordinates: (-180:179.5, -90:90, 10:1040). Assumes all axes are ordered in ascending order.
 		*/
 	virtual TValue Sample(const TDomainCoord& coord) const
+	{
+		return Sample(Locate(coord));
+	}
+
+	// Samples the field at a location computed by Locate of a grid with the same resolution and domain.
+	TValue Sample(const RegularGridLocation<TDimensions>& location) const
+	{
+		TValue result{ 0 };
+		for (size_t i = 0; i < location.NumCorners; ++i) {
+			result += static_cast<TValueType>(mData[location.corner_index[i]] * location.weight[i]);
+		}
+		return result;
+	}
+
+	// Computes the corners and weights for sampling at the domain coordinates coord.
+	RegularGridLocation<TDimensions> Locate(const TDomainCoord& coord) const
 	{
 		TDomainCoord position = this->mDomain.ClampToDomain(coord);
 		TDomainCoord vfTex = (position - this->mDomain.GetMin()) / (this->mDomain.GetMax() - this->mDomain.GetMin());
@@ -47,9 +74,8 @@ public:
 		}
 		TDomainCoord vfSampleInterpol = vfSample - static_cast<TDomainCoord>(viSampleBase0);
 
-		size_t numCorners = (size_t)std::pow(2, TDomainCoord::Dimensions);
-		TValue result{ 0 };
-		for (size_t i = 0; i < numCorners; ++i) {
+		RegularGridLocation<TDimensions> location;
+		for (size_t i = 0; i < location.NumCorners; ++i) {
 			typename TDomainCoord::TScalar weight(1);
 			TGridCoord gridCoord;
 			for (size_t d = 0; d < TDomainCoord::Dimensions; ++d) {
@@ -62,9 +88,10 @@ public:
 					weight *= 1 - vfSampleInterpol[d];
 				}
 			}
-			result += static_cast<TValueType>(GetVertexDataAt(gridCoord) * (float)weight);
+			location.corner_index[i] = GetLinearIndex(gridCoord);
+			location.weight[i] = (float)weight;
 		}
-		return result;
+		return location;
 	}
 
 	// Gets the linear array index based on a grid coordinate index.
@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/*
+	The seeds of a batch which are traced speculatively in parallel, in the order in which they are committed. A trace which passes a later seed
+	of the batch would remove that seed when it is committed, so it flags the seed and the trace of the flagged seed can stop at once.
+	A trace which passes an earlier seed of the batch most likely follows the same jet as the trace of that seed, which will remove its seed,
+	so it flags its own seed. The flags are atomic, such that the traces can set and check them while they run.
+	A seed is identified by its index in the list of all seeds.
+*/
+class SeedBatch
+{
+public:
+	SeedBatch(const size_t& n_seeds) :
+		rank_(n_seeds, -1)
+	{
+	}
+
+	size_t GetSize() const { return seeds_.size(); }
+	const size_t& GetSeed(const int& rank) const { return seeds_[rank]; }
+
+	void Assign(const std::vector<size_t>& seeds) {
+		for (const size_t& seed : seeds_) {
+			rank_[seed] = -1;
+		}
+		seeds_ = seeds;
+		passed_.reset(new std::atomic<bool>[seeds_.size()]);
+		for (size_t r = 0; r < seeds_.size(); r++) {
+			rank_[seeds_[r]] = (int)r;
+			passed_[r].store(false, std::memory_order_relaxed);
+		}
+	}
+
+	/*
+		Called by the trace of the seed with the given rank when it passes the seed. Flags the later seed of the batch, or the own seed of the trace
+		if it passes an earlier seed of the batch.
+	*/
+	void Pass(const int& rank, const size_t& seed) {
+		const int seed_rank = rank_[seed];
+		if (seed_rank > rank) {
+			passed_[seed_rank].store(true, std::memory_order_relaxed);
+		}
+		else if (seed_rank >= 0 && seed_rank < rank) {
+			passed_[rank].store(true, std::memory_order_relaxed);
+		}
+	}
+
+	/*
+		Returns true if the trace of the seed with the given rank should stop.
+	*/
+	bool IsPassed(const int& rank) const {
+		return passed_[rank].load(std::memory_order_relaxed);
+	}
+
+private:
+	std::vector<size_t> seeds_;
+	// The rank of every seed in the batch, -1 for the seeds which are not in the batch.
+	std::vector<int> rank_;
+	std::unique_ptr<std::atomic<bool>[]> passed_;
+};
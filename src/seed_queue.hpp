@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+/*
+	Seeds ordered by decreasing key, e.g. the wind magnitude, which is computed once per seed. A seed is identified by its index in the list of keys.
+	The order is a sorted array of seed indices, removed seeds are only marked. Removing a seed is O(1) and the front skips removed seeds.
+	Seeds with equal keys are ordered by their index.
+*/
+class SeedQueue
+{
+public:
+	SeedQueue(const std::vector<float>& keys) :
+		order_(keys.size()),
+		removed_(keys.size(), false),
+		front_(0),
+		size_(keys.size())
+	{
+		std::iota(order_.begin(), order_.end(), (size_t)0);
+		std::stable_sort(order_.begin(), order_.end(), [&keys](const size_t& a, const size_t& b) { return keys[a] > keys[b]; });
+	}
+
+	bool IsEmpty() const { return size_ == 0; }
+	size_t GetSize() const { return size_; }
+	bool Contains(const size_t& seed) const { return !removed_[seed]; }
+
+	void Remove(const size_t& seed) {
+		if (removed_[seed]) return;
+		removed_[seed] = true;
+		size_--;
+	}
+
+	/*
+		Returns the first n seeds in order, which are not removed, without removing them.
+	*/
+	void GetFront(const size_t& n, std::vector<size_t>& seeds) {
+		while (front_ < order_.size() && removed_[order_[front_]]) {
+			front_++;
+		}
+		seeds.clear();
+		for (size_t i = front_; i < order_.size() && seeds.size() < n; i++) {
+			if (!removed_[order_[i]]) {
+				seeds.push_back(order_[i]);
+			}
+		}
+	}
+
+private:
+	std::vector<size_t> order_;
+	std::vector<bool> removed_;
+	// All seeds before front_ in order_ are removed.
+	size_t front_;
+	size_t size_;
+};
@@ -1,69 +1,61 @@
-﻿#include <time.h>
-
-#include "data_helper.hpp"
+﻿#include <cstdio>
 
 #include "time_helper.hpp"
 
-time_t TimeHelper::ToTimeT(std::string& date) {
-	int start_year = std::stoi(date.substr(0, 4));
-	int start_month = std::stoi(date.substr(4, 2));
-	int start_day = std::stoi(date.substr(6, 2));
-	int start_hour = std::stoi(date.substr(9, 2));
-	struct tm data_tm = { 0, 0, start_hour, start_day, start_month - 1, start_year - 1900 };//-isdst = -1 lets mktime decide the summer or wintertime flag
-	data_tm.tm_isdst = -1;
-	return mktime(&data_tm);
+/*
+	Days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+*/
+static int64_t DaysFromCivil(int64_t year, const int64_t& month, const int64_t& day) {
+	year -= month <= 2;
+	const int64_t era = (year >= 0 ? year : year - 399) / 400;
+	const int64_t year_of_era = year - era * 400;
+	const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
 }
 
-#pragma warning(push)
-#pragma warning(disable: 4996)
 /*
-		Converts hours since the first time step to date. Need to take care of summer and winter time. Thats why we add one hour in the winter.
+	Inverse of DaysFromCivil.
 */
-std::string TimeHelper::ConvertHoursToDate(const size_t& hours, const std::string& data_start_date) {
-	std::string data_start_date_c = data_start_date;
-	time_t data_start_time_t = ToTimeT(data_start_date_c);
-	char out[30];
-	struct tm* stm = localtime(&data_start_time_t);
-	stm->tm_hour += (int)(hours);
-	mktime(stm);
-	if (stm->tm_isdst == 0) {//In winter time, add 1 hour. Otherwise two hours will map to the same time step.
-		stm->tm_hour++;
-	}
-	mktime(stm);
-	strftime(out, 30, "%Y%m%d_%H", stm);
-
-	char out2[30];
-	strftime(out2, 30, "%Y%m%d_%H", localtime(&data_start_time_t));
-
-	return std::string(out);
+static void CivilFromDays(int64_t days, int64_t& year, int64_t& month, int64_t& day) {
+	days += 719468;
+	const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	const int64_t day_of_era = days - era * 146097;
+	const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	const int64_t mp = (5 * day_of_year + 2) / 153;
+	day = day_of_year - (153 * mp + 2) / 5 + 1;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year = year_of_era + era * 400 + (month <= 2);
 }
-#pragma warning(pop)
 
-size_t TimeHelper::ConvertDateToHours(const std::string& date, const std::string& data_start_date) {
-	std::string data_start_date_c = data_start_date;
+int64_t TimeHelper::ToHoursSinceEpoch(const std::string& date) {
 	int year = std::stoi(date.substr(0, 4));
 	int month = std::stoi(date.substr(4, 2));
 	int day = std::stoi(date.substr(6, 2));
 	int hour = std::stoi(date.substr(9, 2));
-	struct tm stm = { 0, 0, hour, day, month - 1, year - 1900 };//-isdst = -1 lets mktime decide the summer or wintertime flag
-	stm.tm_isdst = -1;
+	return DaysFromCivil(year, month, day) * 24 + hour;
+}
 
-	time_t new_time = mktime(&stm);
-	int test = stm.tm_isdst;
-	double diff = difftime(new_time, ToTimeT(data_start_date_c));
-	diff = diff / 3600;
-	size_t hours;
-	if (stm.tm_isdst == 0) {
-		/*
-			If we have winter time, then the clocks are set one hour back. This means, we should have two time steps for the hour where the time is set back.(As phyisally two hours passed)
-			Because we don't have this additional time step, we need to subtract 1 hour in the winter time. Otherwise we would be shifted by 1 hour.
-		*/
-		hours = (size_t)std::round(diff - 1);
-	}
-	else {
-		hours = (size_t)std::round(diff);
-	}
-	return hours;
+std::string TimeHelper::FromHoursSinceEpoch(const int64_t& hours) {
+	int64_t days = hours >= 0 ? hours / 24 : (hours - 23) / 24;
+	int64_t hour = hours - days * 24;
+	int64_t year, month, day;
+	CivilFromDays(days, year, month, day);
+	char out[30];
+	snprintf(out, sizeof(out), "%04d%02d%02d_%02d", (int)year, (int)month, (int)day, (int)hour);
+	return std::string(out);
+}
+
+/*
+	Converts hours since the first time step to date.
+*/
+std::string TimeHelper::ConvertHoursToDate(const size_t& hours, const std::string& data_start_date) {
+	return FromHoursSinceEpoch(ToHoursSinceEpoch(data_start_date) + (int64_t)hours);
+}
+
+size_t TimeHelper::ConvertDateToHours(const std::string& date, const std::string& data_start_date) {
+	return (size_t)(ToHoursSinceEpoch(date) - ToHoursSinceEpoch(data_start_date));
 }
 size_t TimeHelper::GetMonthFromHours(const size_t& time, const std::string& data_start_date) {
 	std::string date = ConvertHoursToDate(time, data_start_date);
@@ -1,10 +1,16 @@
 ﻿#pragma once
+#include <cstdint>
 #include <string>
 
 class TimeHelper
 {
+	/*
+		Conversions between dates of the form YYYYMMDD_HH and hours since the first time step.
+		The dates are treated as UTC, such that every hour maps to exactly one date, independent of the time zone and daylight saving time of the machine.
+	*/
 public:
-	static time_t ToTimeT(std::string& date);
+	static int64_t ToHoursSinceEpoch(const std::string& date);
+	static std::string FromHoursSinceEpoch(const int64_t& hours);
 	static std::string ConvertHoursToDate(const size_t& time, const std::string& data_start_date);
 	static size_t ConvertDateToHours(const std::string& date, const std::string& data_start_date);
 	static size_t GetMonthFromHours(const size_t& time, const std::string& data_start_date);
@@ -1,103 +1,129 @@
 ﻿#include "gradient.hpp"
+#include "grid_iteration.hpp"
 
 #include "wind_fields.hpp"
 
 WindFields::WindFields() {}
 
 /*
-		Computes the normalized wind direction.
+		Computes the normalized wind direction and the wind magnitude in a single pass over U, V, OMEGA, T and the pressure of the model levels.
+		The direction uses OMEGA / 100 as vertical component, the magnitude uses the vertical velocity w in m/s.
 */
-EraVectorField3f* WindFields::GetNormalizedWindDirectionEra(const size_t& time, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega) {
-
-	RegVectorField3f* wind_direction = new RegVectorField3f(Vec3i({ u->GetResolution()[0], u->GetResolution()[1], u->GetResolution()[2] }), u->GetDomain());
-
-	size_t num_entries = (size_t)wind_direction->GetResolution()[0] * (size_t)wind_direction->GetResolution()[1] * (size_t)wind_direction->GetResolution()[2];
-#pragma omp parallel for schedule(dynamic,16)
-	for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-		Vec3i coords = wind_direction->GetGridCoord(linear_index);
-		Vec3f wind_dir = Vec3f({ u->GetVertexDataAt(coords),v->GetVertexDataAt(coords), omega->GetVertexDataAt(coords) / 100 });
-		Vec3f wind_dir_norm = wind_dir / wind_dir.length();
-		wind_direction->SetVertexDataAt(coords, wind_dir_norm);
-	}
-
-	EraVectorField3f* era = new EraVectorField3f(wind_direction, ps3d);
-	return era;
+void WindFields::GetWindDirectionAndMagnitudeEra(const HybridPressure* pressure, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature, EraVectorField3f*& wind_direction_normalized, EraScalarField3f*& wind_magnitude) {
+	RegVectorField3f* wind_direction = new RegVectorField3f(u->GetResolution(), u->GetDomain());
+	RegScalarField3f* norm_wind_vector = new RegScalarField3f(u->GetResolution(), u->GetDomain());
+
+	const float* u_data = u->GetData().data();
+	const float* v_data = v->GetData().data();
+	const float* omega_data = omega->GetData().data();
+	const float* t_data = temperature->GetData().data();
+	Vec3f* direction_data = wind_direction->GetData().data();
+	float* magnitude_data = norm_wind_vector->GetData().data();
+
+	const float rgas = 287.058f; //J / (kg - K) = > m2 / (s2 K)
+	const float g = 9.80665f;// m / s2
+	ForEachVoxel(u->GetResolution(), [&](const int& i, const int& j, const int& k, const int64_t& linear_index) {
+		float u_at = u_data[linear_index];
+		float v_at = v_data[linear_index];
+		float omega_pa = omega_data[linear_index];
+
+		Vec3f wind_dir = Vec3f({ u_at, v_at, omega_pa / 100 });
+		direction_data[linear_index] = wind_dir / wind_dir.length();
+
+		float p = pressure->GetPressure(i, j, k) * 100;
+		float rho = p / (rgas * t_data[linear_index]); //density = > kg / m3
+		float w = -omega_pa / (rho * g);
+		magnitude_data[linear_index] = std::sqrt(u_at * u_at + v_at * v_at + w * w);
+	});
+
+	wind_direction_normalized = new EraVectorField3f(wind_direction, pressure);
+	wind_magnitude = new EraScalarField3f(norm_wind_vector, pressure);
 }
 
-EraScalarField3f* WindFields::GetWindMagnitudeEra(const size_t& time, const std::vector<float>& ps_axis_values, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature) {
-
-	RegScalarField3f* w = Convert_pa_to_m(omega, temperature, time, ps_axis_values, ps3d);
-
-	BoundingBox3d dom = u->GetDomain();
-
-	RegScalarField3f* norm_wind_vector = new RegScalarField3f(Vec3i({ u->GetResolution()[0], u->GetResolution()[1],u->GetResolution()[2] }), u->GetDomain());
-	int num_tuples = norm_wind_vector->GetResolution()[0] * norm_wind_vector->GetResolution()[1] * norm_wind_vector->GetResolution()[2];
-
-#pragma omp parallel for schedule(dynamic,16)
-	for (int linear_index = 0; linear_index < num_tuples; ++linear_index)
-	{
-		Vec3i grid_coord = norm_wind_vector->GetGridCoord(linear_index);
-		float u_at_grid_coord = u->GetVertexDataAt(grid_coord);
-		float v_at_grid_coord = v->GetVertexDataAt(grid_coord);
-		float om_at_grid_coord = w->GetVertexDataAt(grid_coord);
-		norm_wind_vector->SetVertexDataAt(grid_coord, std::sqrt(u_at_grid_coord * u_at_grid_coord + v_at_grid_coord * v_at_grid_coord + om_at_grid_coord * om_at_grid_coord));
-	}
-	EraScalarField3f* era = new EraScalarField3f(norm_wind_vector, ps3d);
-
-	delete w;
-	return era;
+/*
+		Box filter along the rows of the grid, which are contiguous in memory. Indices outside of the row are clamped to the first or last vertex.
+		The window sum is updated incrementally while moving along the row.
+*/
+static void BoxFilterRows(const float* in, float* out, const Vec3i& res, const int& radius) {
+	const int row_length = res[0];
+	ForEachRow(res, [&](const int&, const int&, const int64_t& row_index) {
+		const float* in_row = in + row_index;
+		float* out_row = out + row_index;
+		double sum = 0.0;
+		for (int d = -radius; d <= radius; d++) {
+			sum += in_row[std::max(0, std::min(row_length - 1, d))];
+		}
+		for (int i = 0; i < row_length; i++) {
+			out_row[i] = (float)sum;
+			sum += in_row[std::min(row_length - 1, i + radius + 1)] - in_row[std::max(0, i - radius)];
+		}
+	});
 }
 
-EraScalarField3f* WindFields::GetSmoothWindMagnitude(const size_t& time, const std::vector<float>& ps_axis_values, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature) {
-	EraScalarField3f* wind_mag_era = GetWindMagnitudeEra(time, ps_axis_values, ps3d, u, v, omega, temperature);
-	RegScalarField3f* field = wind_mag_era->GetField();
-	RegScalarField3f* smooth = new RegScalarField3f(field->GetResolution(), field->GetDomain());
-
-	int num_tuples = field->GetResolution()[0] * field->GetResolution()[1] * field->GetResolution()[2];
-	int x_filter = 3;
-	int y_filter = 3;
-	int z_filter = 1;
-
-#pragma omp parallel for schedule(dynamic,16)
-
-	for (int linear_index = 0; linear_index < num_tuples; ++linear_index)
-	{
-		Vec3i grid_coord = field->GetGridCoord(linear_index);
-
-		double avg = 0.0;
-		for (int i = -x_filter; i <= x_filter; i++) {
-			for (int j = -y_filter; j <= y_filter; j++) {
-				for (int k = -z_filter; k <= z_filter; k++) {
-					int x = grid_coord[0] + i;
-					int y = grid_coord[1] + j;
-					int z = grid_coord[2] + k;
-					if (x > 0 && x < field->GetResolution()[0] && y > 0 && y < field->GetResolution()[1] && z > 0 && z < field->GetResolution()[2]) {
-						avg += field->GetVertexDataAt(Vec3i({ x, y, z }));
-					}
-					else {
-						x = std::max(0, std::min(field->GetResolution()[0] - 1, x));
-						y = std::max(0, std::min(field->GetResolution()[1] - 1, y));
-						z = std::max(0, std::min(field->GetResolution()[2] - 1, z));
-						avg += field->GetVertexDataAt(Vec3i({ x, y, z }));
-
-					}
-				}
+/*
+		Box filter along a strided axis. The lines along the axis are processed in blocks of neighboring x coordinates, which are contiguous in memory,
+		such that the inner loop runs over consecutive addresses and is vectorized. Indices outside of the axis are clamped like in BoxFilterRows.
+		The window sums are divided by divisor.
+*/
+static void BoxFilterStrided(const float* in, float* out, const int& nx, const int& axis_length, const size_t& axis_stride, const int& num_outer, const size_t& outer_stride, const int& radius, const double& divisor) {
+	const int block_size = 256;
+	const int num_blocks = (nx + block_size - 1) / block_size;
+#pragma omp parallel for schedule(static)
+	for (int64_t task = 0; task < (int64_t)num_outer * num_blocks; task++) {
+		const int outer = (int)(task / num_blocks);
+		const int x_begin = (int)(task % num_blocks) * block_size;
+		const int x_count = std::min(block_size, nx - x_begin);
+		const float* in_base = in + outer * outer_stride + x_begin;
+		float* out_base = out + outer * outer_stride + x_begin;
+
+		double sum[block_size];
+		for (int x = 0; x < x_count; x++) {
+			sum[x] = 0.0;
+		}
+		for (int d = -radius; d <= radius; d++) {
+			const float* in_line = in_base + std::max(0, std::min(axis_length - 1, d)) * axis_stride;
+			for (int x = 0; x < x_count; x++) {
+				sum[x] += in_line[x];
+			}
+		}
+		for (int i = 0; i < axis_length; i++) {
+			float* out_line = out_base + i * axis_stride;
+			const float* in_add = in_base + std::min(axis_length - 1, i + radius + 1) * axis_stride;
+			const float* in_remove = in_base + std::max(0, i - radius) * axis_stride;
+			for (int x = 0; x < x_count; x++) {
+				out_line[x] = (float)(sum[x] / divisor);
+				sum[x] += in_add[x] - in_remove[x];
 			}
 		}
+	}
+}
+
+/*
+		Smooths the wind magnitude with a box filter of size (2 * filter_radius + 1) in each dimension. The wind magnitude field is not modified.
+		Vertices outside of the grid are clamped to the closest vertex on the boundary.
+		The filter is separable and applied as one running sum pass per axis. The intermediate sums are stored as floats,
+		so the result differs from summing the full window in double precision by float rounding only.
+*/
+EraScalarField3f* WindFields::GetSmoothWindMagnitude(const HybridPressure* pressure, RegScalarField3f* field, const Vec3i& filter_radius) {
+	const Vec3i& res = field->GetResolution();
+	RegScalarField3f* smooth = new RegScalarField3f(res, field->GetDomain());
+	std::vector<float> temp(smooth->GetData().size());
 
-		smooth->SetVertexDataAt(grid_coord, (float)(avg / ((2.0 * x_filter + 1) * (2.0 * y_filter + 1) * (2.0 * z_filter + 1))));
+	const size_t slice_size = (size_t)res[0] * (size_t)res[1];
+	const double divisor = (2.0 * filter_radius[0] + 1) * (2.0 * filter_radius[1] + 1) * (2.0 * filter_radius[2] + 1);
 
-	}
-	delete field;
-	delete wind_mag_era;
-	return new EraScalarField3f(smooth, ps3d);;
+	BoxFilterRows(field->GetData().data(), smooth->GetData().data(), res, filter_radius[0]);
+	BoxFilterStrided(smooth->GetData().data(), temp.data(), res[0], res[1], (size_t)res[0], res[2], slice_size, filter_radius[1], 1.0);
+	BoxFilterStrided(temp.data(), smooth->GetData().data(), res[0], res[2], slice_size, res[1], (size_t)res[0], filter_radius[2], divisor);
+
+	return new EraScalarField3f(smooth, pressure);
 }
 
 
-EraVectorField3f* WindFields::GetWindMagnitudeGradientEra(const size_t& time, RegScalarField3f* ps3d, RegScalarField3f* temperature, RegScalarField3f* wind_magnitude) {
+EraVectorField3f* WindFields::GetWindMagnitudeGradientEra(const size_t& time, const HybridPressure* pressure, RegScalarField3f* temperature, RegScalarField3f* wind_magnitude) {
 	Gradient g = Gradient();
 	RegVectorField3f* grad = g.GradientVectorField(wind_magnitude, temperature);
-	EraVectorField3f* era = new EraVectorField3f(grad, ps3d);
+	EraVectorField3f* era = new EraVectorField3f(grad, pressure);
 	return era;
 }
 
@@ -113,25 +139,3 @@ Vec2d WindFields::GetWorldLengthOfDegreeInMeters(const double& lon, const double
 	double lon_in_meters = 111412.84 * cos(phi) - 93.5 * cos(3 * phi) + 0.118 * cos(5 * phi);
 	return Vec2d({ std::abs(lon_in_meters), lat_in_meters });
 }
-
-
-RegScalarField3f* WindFields::Convert_pa_to_m(RegScalarField3f* data, RegScalarField3f* temp, const size_t& time, const std::vector<float>& ps_axis_values, RegScalarField3f* ps3d) {
-	RegScalarField3f* w_field = new RegScalarField3f(data->GetResolution(), data->GetDomain());
-	size_t num_entries = (size_t)data->GetResolution()[0] * (size_t)data->GetResolution()[1] * (size_t)data->GetResolution()[2];
-	float max = 0;
-#pragma omp parallel for schedule(dynamic,16)
-	for (int64_t linear_index = 0; linear_index < (int64_t)num_entries; linear_index++) {
-		Vec3i coords = data->GetGridCoord(linear_index);
-
-		float omega_pa = data->GetVertexDataAt(coords);
-		float t = temp->GetVertexDataAt(coords);
-		float p = ps3d->GetVertexDataAt(coords) * 100;
-		float rgas = 287.058f; //J / (kg - K) = > m2 / (s2 K)
-		float g = 9.80665f;// m / s2
-		float rho = p / (rgas * t); //density = > kg / m3
-		float w = -omega_pa / (rho * g); //array operation
-		w_field->SetVertexDataAt(coords, w);
-		if (std::abs(w) > max) { max = std::abs(w); }
-	}
-	return w_field;
-}
@@ -9,12 +9,10 @@ class WindFields
 public:
 	WindFields();
 
-	EraVectorField3f* GetNormalizedWindDirectionEra(const size_t& time, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega);
-	EraScalarField3f* GetWindMagnitudeEra(const size_t& time, const std::vector<float>& psAxisValues, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature);
-	EraScalarField3f* GetSmoothWindMagnitude(const size_t& time, const std::vector<float>& psAxisValues, RegScalarField3f* ps3d, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature);
-	EraVectorField3f* GetWindMagnitudeGradientEra(const size_t& time, RegScalarField3f* ps3d, RegScalarField3f* temperature, RegScalarField3f* windForce);
+	void GetWindDirectionAndMagnitudeEra(const HybridPressure* pressure, RegScalarField3f* u, RegScalarField3f* v, RegScalarField3f* omega, RegScalarField3f* temperature, EraVectorField3f*& wind_direction_normalized, EraScalarField3f*& wind_magnitude);
+	EraScalarField3f* GetSmoothWindMagnitude(const HybridPressure* pressure, RegScalarField3f* wind_magnitude, const Vec3i& filter_radius = Vec3i({ 3, 3, 1 }));
+	EraVectorField3f* GetWindMagnitudeGradientEra(const size_t& time, const HybridPressure* pressure, RegScalarField3f* temperature, RegScalarField3f* windForce);
 
 private:
-	RegScalarField3f* Convert_pa_to_m(RegScalarField3f* data, RegScalarField3f* temp, const size_t& time, const std::vector<float>& psAxisValues, RegScalarField3f* ps3d);
 	Vec2d GetWorldLengthOfDegreeInMeters(const double& lon, const double& lat);
 };